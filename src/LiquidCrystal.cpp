@@ -4,6 +4,11 @@
 #include <string.h>
 #include <inttypes.h>
 #include "Arduino.h"
+#include "diag.h"
+
+// execution times of the HD44780, clear and home take longer and wait on their own
+#define LCD_COMMAND_USEC 37
+#define LCD_DATA_USEC 41 // the 37 usec plus the address counter update
 
 // When the display powers up, it is configured as follows:
 //
@@ -104,6 +109,7 @@ void LiquidCrystal::begin(uint8_t cols, uint8_t lines, uint8_t dotsize)
   {
     pinMode(_data_pins[i], OUTPUT);
   }
+  setupFastIo();
 
   // SEE PAGE 45/46 FOR INITIALIZATION SPECIFICATION!
   // according to datasheet, we need at least 40ms after power rises above 2.7V
@@ -137,6 +143,7 @@ void LiquidCrystal::begin(uint8_t cols, uint8_t lines, uint8_t dotsize)
 
     // finally, set to 4-bit interface
     write4bits(0x02);
+    delayMicroseconds(LCD_COMMAND_USEC);
   }
   else
   {
@@ -308,10 +315,54 @@ inline size_t LiquidCrystal::write(uint8_t value)
 
 /************ low level data pushing commands **********/
 
+/**
+ * With LCD_FAST_IO (config.h) the pins are written straight to the port
+ * instead of through digitalWrite(), if they allow it: 4 bit mode without a
+ * rw pin, rs, enable and the data pins on one port and d0 to d3 on
+ * consecutive bits in order. The Raduino has them on PORTB (pins 8 to 13),
+ * a nibble is then a single masked store. Other wirings use digitalWrite().
+ */
+void LiquidCrystal::setupFastIo()
+{
+  _port = NULL;
+#if LCD_FAST_IO
+  uint8_t port = digitalPinToPort(_rs_pin);
+  uint8_t d0 = digitalPinToBitMask(_data_pins[0]);
+
+  if ((_displayfunction & LCD_8BITMODE) || _rw_pin != 255)
+    return;
+  if (port == NOT_A_PORT || digitalPinToPort(_enable_pin) != port || d0 > 0x10)
+    return;
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    if (digitalPinToPort(_data_pins[i]) != port || digitalPinToBitMask(_data_pins[i]) != (uint8_t)(d0 << i))
+      return;
+  }
+
+  _rs_mask = digitalPinToBitMask(_rs_pin);
+  _enable_mask = digitalPinToBitMask(_enable_pin);
+  for (_data_shift = 0; !(d0 & 1); d0 >>= 1)
+    _data_shift++;
+  _port = portOutputRegister(port);
+#endif
+}
+
 // write either command or data, with automatic 4/8-bit selection
 void LiquidCrystal::send(uint8_t value, uint8_t mode)
 {
-  digitalWrite(_rs_pin, mode);
+  PROFILE(PROF_LCD);
+  if (_port)
+  {
+    uint8_t sreg = SREG;
+    cli();
+    if (mode)
+      *_port |= _rs_mask;
+    else
+      *_port &= ~_rs_mask;
+    SREG = sreg;
+  }
+  else
+    digitalWrite(_rs_pin, mode);
 
   // if there is a RW pin indicated, set it low to Write
   if (_rw_pin != 255)
@@ -328,23 +379,49 @@ void LiquidCrystal::send(uint8_t value, uint8_t mode)
     write4bits(value >> 4);
     write4bits(value);
   }
+
+  // the display is busy until the byte has been executed
+  delayMicroseconds(mode ? LCD_DATA_USEC : LCD_COMMAND_USEC);
 }
 
+// the enable pin is low between pulses, the data is latched on the falling edge
 void LiquidCrystal::pulseEnable(void)
 {
+  if (_port)
+  {
+    uint8_t sreg = SREG;
+    cli();
+    *_port |= _enable_mask;
+    SREG = sreg;
+    delayMicroseconds(1); // enable pulse must be >450ns
+    cli();
+    *_port &= ~_enable_mask;
+    SREG = sreg;
+    return;
+  }
+
   digitalWrite(_enable_pin, LOW);
   delayMicroseconds(1);
   digitalWrite(_enable_pin, HIGH);
   delayMicroseconds(1); // enable pulse must be >450ns
   digitalWrite(_enable_pin, LOW);
-  delayMicroseconds(100); // commands need > 37us to settle
 }
 
 void LiquidCrystal::write4bits(uint8_t value)
 {
-  for (int i = 0; i < 4; i++)
+  if (_port)
   {
-    digitalWrite(_data_pins[i], (value >> i) & 0x01);
+    uint8_t sreg = SREG;
+    cli();
+    *_port = (*_port & ~(0x0F << _data_shift)) | ((value & 0x0F) << _data_shift);
+    SREG = sreg;
+  }
+  else
+  {
+    for (int i = 0; i < 4; i++)
+    {
+      digitalWrite(_data_pins[i], (value >> i) & 0x01);
+    }
   }
 
   pulseEnable();
@@ -89,12 +89,19 @@ private:
   void write4bits(uint8_t);
   void write8bits(uint8_t);
   void pulseEnable();
+  void setupFastIo();
 
   uint8_t _rs_pin; // LOW: command.  HIGH: character.
   uint8_t _rw_pin; // LOW: write to LCD.  HIGH: read from LCD.
   uint8_t _enable_pin; // activated by a HIGH pulse.
   uint8_t _data_pins[8];
 
+  // fast i/o: rs, enable and the four data pins on one port, the data pins in order
+  volatile uint8_t *_port; // NULL when the pins don't allow it, see setupFastIo()
+  uint8_t _rs_mask;
+  uint8_t _enable_mask;
+  uint8_t _data_shift; // bit of d0
+
   uint8_t _displayfunction;
   uint8_t _displaycontrol;
   uint8_t _displaymode;
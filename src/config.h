@@ -26,6 +26,23 @@
 #define LOWEST_FREQ (100000l)
 #define HIGHEST_FREQ (30000000l)
 
+// set to 1 to tune the first oscillator (CLK2) with PLLB and an even integer
+// output divider instead of a fractional divider, see ubitx_si5351.cpp
+#define PLL_VFO_MODE 0
+
+// set to 1 to build in the section profiler, see diag.h
+#define PROFILE_SECTIONS 0
+
+// set to 1 to build in the event trace, see diag.h
+#define TRACE_EVENTS 0
+
+// set to 0 to drive the LCD through digitalWrite(), see LiquidCrystal.cpp
+#define LCD_FAST_IO 1
+
+// set to 1 to reset the radio when the loop hangs, only with the new (Optiboot)
+// bootloader, see ubitx_watchdog.cpp
+#define STALL_WATCHDOG 0
+
 /**
  *  The second set of 16 pins on the Raduino's bottom connector are have the three clock outputs and the digital lines to control the rig.
  *  This assignment is as follows :
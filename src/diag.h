@@ -0,0 +1,91 @@
+#ifndef DIAG_H
+#define DIAG_H
+
+/**
+ * Section profiler
+ *
+ * Put PROFILE(id) at the top of a block to add the time until the end of the
+ * block to the section 'id'. For each section the number of calls, the total
+ * and the longest time are kept, see ubitx_diag.cpp. This header stands on its
+ * own so the LiquidCrystal library can use it as well.
+ *
+ * With PROFILE_SECTIONS at 0 (config.h) PROFILE() is empty and costs nothing.
+ */
+
+#include "config.h"
+
+enum
+{
+  PROF_I2C,    // queueing and flushing Si5351 writes
+  PROF_LCD,    // each byte sent to the display
+  PROF_EEPROM, // saving the settings
+  PROF_ADC,    // reading the keyer
+  PROF_METER,  // sampling and drawing the S-meter
+  PROF_COUNT
+};
+
+#if PROFILE_SECTIONS
+
+void profileAdd(uint8_t id, uint32_t usecs);
+
+class ProfileSection
+{
+public:
+  ProfileSection(uint8_t id) : id(id), start(micros()) {}
+  ~ProfileSection() { profileAdd(id, micros() - start); }
+
+private:
+  uint8_t id;
+  uint32_t start;
+};
+
+#define PROFILE(id) ProfileSection profileSection_(id)
+
+#else
+
+#define PROFILE(id)
+
+#endif
+
+void profileSend();
+void profileReset();
+
+/**
+ * Event trace
+ *
+ * TRACE(event, arg) records an event with a 16 bit argument in a small ring,
+ * each with the time since the one before. The ring is read over CAT and
+ * tools/trace_to_chrome.py turns it into a timeline for the browser.
+ *
+ * With TRACE_EVENTS at 0 (config.h) TRACE() is empty and costs nothing.
+ */
+
+enum
+{
+  TR_START_TX = 1, // arg: tx mode
+  TR_STOP_TX,
+  TR_FREQ,         // arg: frequency in khz
+  TR_CAT,          // arg: opcode
+  TR_KEY_DOWN,
+  TR_KEY_UP,
+  TR_MENU_ENTER,
+  TR_MENU_EXIT,
+  TR_I2C,          // arg: register << 8 | number of bytes
+};
+
+#if TRACE_EVENTS
+
+void traceAdd(uint8_t event, uint16_t arg);
+
+#define TRACE(event, arg) traceAdd(event, arg)
+
+#else
+
+#define TRACE(event, arg)
+
+#endif
+
+void traceSend();
+void traceReset();
+
+#endif // DIAG_H
@@ -3,6 +3,7 @@
 
 #include <Arduino.h>
 #include "config.h"
+#include "diag.h"
 
 // ============================================================================
 // Function Prototypes - uBITX v5
@@ -20,6 +21,7 @@ void stopTx();
 void ritEnable(uint32_t f);
 void ritDisable();
 void checkPTT();
+void saveVfoLater(uint8_t vfo);
 void doTuning();
 void doRIT();
 void initSettings();
@@ -36,20 +38,123 @@ void drawMeter(int8_t needle);
 void printLine(int linenmbr, const char *c);
 void printLine1(const char *c);
 void printLine2(const char *c);
+void printActivity(bool on);
+void displayFlush();
+void displaySync();
 void updateDisplay();
+void enc_init();
+bool enc_pop(int8_t *step, uint16_t *time);
 int enc_read(void);
+void enc_reset();
 
 bool readEncPtt();
 bool readEncA();
 bool readEncB();
 
+// ============================================================================
+// ubitx_sched.cpp
+// ============================================================================
+#define TASK_YIELD 0x01 // may run from inside a wait
+#define TASK_RADIO 0x02 // retunes or keys the radio, see sched_hold()
+
+typedef struct
+{
+    void (*run)();
+    uint16_t period;   // msecs between runs, 0 runs on every pass
+    uint16_t deadline; // msecs a run may start late before it is counted as missed
+    uint8_t priority;  // the lowest number runs first when several are due
+    uint8_t flags;
+} task_t;
+
+void sched_init(const task_t *tasks, uint8_t count);
+void sched_run();
+void sched_yield();
+uint8_t sched_hold(uint8_t flags);
+uint16_t sched_late(uint8_t task);
+uint16_t sched_misses(uint8_t task);
+uint8_t sched_current();
+
+// ============================================================================
+// ubitx_watchdog.cpp
+// ============================================================================
+void watchdogInit();
+void watchdogArm();
+void watchdogFeed();
+void watchdogLoop();
+void watchdogSend();
+void watchdogReset();
+
+// ============================================================================
+// ubitx_meter.cpp
+// ============================================================================
+void meterTask();
+
+// ============================================================================
+// ubitx_knob.cpp
+// ============================================================================
+#define KNOB_SLOWEST 0xFFFF // interval of the last entry of a knob curve
+
+typedef struct
+{
+    uint16_t interval; // filtered time between edges in 64 usec ticks, up to
+    uint16_t rate;     // quarter units per edge
+} knobCurve_t;
+
+int32_t knob_read(const knobCurve_t *curve);
+uint16_t knob_step();
+void knob_reset();
+
+// ============================================================================
+// ubitx_bcd.cpp
+// ============================================================================
+uint8_t bcd_digit(uint8_t pos);
+const uint8_t *bcd_sync();
+
 // ============================================================================
 // ubitx_si5351.ino
 // ============================================================================
+typedef struct
+{
+    uint32_t fout; // 0 when the state is not valid
+    uint32_t msq;
+    uint32_t msr;
+} si5351bx_div_t; // the output divider of a clock, kept for incremental steps
+
+typedef struct
+{
+    uint8_t image[32]; // registers 34 to 65, PLLB and msynth 0 to 2
+    uint8_t ctrl[3];   // registers 16 to 18
+    uint8_t clken;     // register 3
+    uint8_t vfodiv;
+    si5351bx_div_t div[3]; // the dividers behind the image
+    uint32_t vcoa; // the calibration the registers were computed with
+} si5351bx_bank_t;
+
+extern uint32_t si5351bx_vcoa;
+void si5351bx_stage(uint8_t clknum, uint32_t fout);
+void si5351bx_commit();
+void si5351bx_save(si5351bx_bank_t *bank);
+bool si5351bx_load(const si5351bx_bank_t *bank);
 void si5351bx_setfreq(uint8_t clknum, uint32_t fout);
 void si5351_set_calibration(int32_t cal);
 void initOscillators(uint32_t calibration);
 
+// ============================================================================
+// ubitx_i2c.cpp
+// ============================================================================
+void i2cInit();
+void i2cQueueWrite(uint8_t addr, uint8_t reg, const uint8_t *vals, uint8_t vcnt);
+bool i2cBusy();
+void i2cFlush();
+extern volatile uint8_t i2cErrors; // transactions dropped, they never reached the chip
+
+// ============================================================================
+// ubitx_diag.cpp
+// ============================================================================
+void loopStatsMark();
+void loopStatsReset();
+void loopStatsSend();
+
 // ============================================================================
 // ubitx_menu.ino
 // ============================================================================
@@ -82,11 +187,12 @@ uint8_t setHighNibble(uint8_t b, uint8_t v);
 uint8_t setLowNibble(uint8_t b, uint8_t v);
 uint8_t getHighNibble(uint8_t b);
 uint8_t getLowNibble(uint8_t b);
-void getDecimalDigits(uint32_t number, uint8_t *result, int digits);
-void writeFreq(uint32_t freq, uint8_t *cmd);
+void writeFreq(uint8_t *cmd);
 uint32_t readFreq(uint8_t *cmd);
 void processCATCommand2(uint8_t *cmd);
 void checkCAT();
+void catStateChanged();
+extern uint8_t catLastOpcode;
 
 // we directly generate the CW by programmin the Si5351 to the cw tx frequency, hence, both are different modes
 // these are the parameter passed to startTx
@@ -119,6 +225,9 @@ void checkCAT();
 // handkey, iambic a, iambic b : 0,1,2f
 #define CW_KEY_TYPE 358
 
+// the last four watchdog resets, 33 bytes, see ubitx_watchdog.cpp
+#define WDT_HISTORY 384
+
 /***********************************************************************************************************************
  * EEPROM END
  */
@@ -150,7 +259,7 @@ typedef struct
 extern settings_t settings;
 extern char cBuf[30];
 extern char bBuf[30];
-extern char printBuff[2][31]; // mirrors what is showing on the two lines of the display
+extern char printBuff[2][17]; // mirrors what is showing on the two lines of the display, padded to 16 columns
 extern uint32_t usbCarrier;
 extern uint8_t keyerControl;
 extern bool Iambic_Key;
@@ -158,6 +267,7 @@ extern bool Iambic_Key;
 extern char isUsbVfoA;
 extern char isUsbVfoB;
 
+extern bool simulateIO;
 void HandleSimIo();
 bool pttOn();
 
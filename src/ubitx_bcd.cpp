@@ -0,0 +1,103 @@
+/**
+ * The frequency in decimal
+ *
+ * The display shows the frequency digit by digit and CAT sends it as BCD,
+ * both of them used to take settings.frequency apart with a divide for every
+ * digit, on every retune. On the ATmega each 32 bit divide is a loop of a
+ * few hundred cycles.
+ *
+ * Here a copy of the frequency is kept as packed BCD, laid out as CAT sends
+ * it: [d8 d7][d6 d5][d4 d3][d2 d1][d0 -], d0 being the hertz. When it is
+ * read, the difference to settings.frequency is added or taken off a decade
+ * at a time with a decimal carry, by subtracting the powers of ten rather
+ * than dividing. A tuning step touches one or two decades, a jump to another
+ * band at most all nine of them.
+ */
+
+#include "global.h"
+
+#define BCD_DIGITS 9
+
+static uint8_t bcdFreq[5];  // the frequency as packed BCD
+static uint32_t bcdHz = 0;  // the same in binary, what bcdFreq holds now
+
+static const uint32_t bcdDecades[BCD_DIGITS] PROGMEM = {
+    100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10, 1};
+
+// the digit at decade 'pos', 0 is the hertz
+uint8_t bcd_digit(uint8_t pos)
+{
+  if (pos & 1)
+    return bcdFreq[4 - (pos + 1) / 2] & 0x0F;
+  return bcdFreq[4 - pos / 2] >> 4;
+}
+
+static void bcdSetDigit(uint8_t pos, uint8_t d)
+{
+  uint8_t *b;
+
+  if (pos & 1)
+  {
+    b = &bcdFreq[4 - (pos + 1) / 2];
+    *b = (*b & 0xF0) | d;
+  }
+  else
+  {
+    b = &bcdFreq[4 - pos / 2];
+    *b = (*b & 0x0F) | (d << 4);
+  }
+}
+
+// adds (or takes off) n at decade 'pos' and carries into the decades above
+static void bcdAddDigit(uint8_t pos, uint8_t n, bool down)
+{
+  for (; pos < BCD_DIGITS; pos++)
+  {
+    int8_t d = bcd_digit(pos) + (down ? -(int8_t)n : n);
+
+    if (d >= 10)
+      d -= 10;
+    else if (d < 0)
+      d += 10;
+    else
+    {
+      bcdSetDigit(pos, d);
+      return;
+    }
+    bcdSetDigit(pos, d);
+    n = 1;
+  }
+}
+
+static void bcdStep(uint32_t delta, bool down)
+{
+  for (uint8_t i = 0; i < BCD_DIGITS && delta; i++)
+  {
+    uint32_t decade = pgm_read_dword(&bcdDecades[i]);
+    uint8_t n = 0;
+
+    while (delta >= decade)
+    {
+      delta -= decade;
+      n++;
+    }
+    if (n)
+      bcdAddDigit(BCD_DIGITS - 1 - i, n, down);
+  }
+}
+
+/**
+ * Brings the BCD copy up to settings.frequency and returns it, the first
+ * four bytes are the frequency in tens of hertz as a CAT reply has it.
+ */
+const uint8_t *bcd_sync()
+{
+  uint32_t f = settings.frequency;
+
+  if (f > bcdHz)
+    bcdStep(f - bcdHz, false);
+  else if (f < bcdHz)
+    bcdStep(bcdHz - f, true);
+  bcdHz = f;
+  return bcdFreq;
+}
@@ -3,13 +3,417 @@
 
 #include "global.h"
 
-static uint32_t rxBufferArriveTime = 0;
-static uint8_t rxBufferCheckCount = 0;
-static uint8_t cat[5];
+static uint8_t cat[5]; // the frame being answered
 static uint8_t insideCat = 0;
+uint8_t catLastOpcode = 0; // left in the watchdog's breadcrumb
+
+// the frame being received and the frames waiting to be answered
+#define CAT_QUEUE_SIZE 4 // a power of two
+static uint8_t catFrame[7]; // long enough for a streaming frame
+static uint8_t catFill = 0;
+static uint32_t catLastByte = 0; // when the last byte was read
+static uint32_t catQuiet = 0;    // when the serial port was last seen empty
+static uint8_t catQueue[CAT_QUEUE_SIZE][5];
+static uint8_t catHead = 0; // frames received, it wraps
+static uint8_t catTail = 0; // frames answered
+
+// for broken protocol, msecs between the bytes of a frame (a byte takes 0.26 msec at 38400 baud)
+#define CAT_BYTE_TIMEOUT 5
+
+/**
+ * A byte that is waiting now came in after the port was last seen empty.
+ * If that was longer than the timeout after the last byte of a partial
+ * frame, there was a gap and the partial frame is dropped, even when the
+ * next frame is already waiting behind it. A slow loop cannot cause a drop,
+ * the port has to be seen empty first.
+ */
+static bool catGap()
+{
+  return (int32_t)(catQuiet - catLastByte) > CAT_BYTE_TIMEOUT;
+}
+
+static uint8_t catReadByte(uint32_t now)
+{
+  if (catFill > 0 && catGap())
+    catFill = 0;
+  uint8_t b = Serial.read();
+  catLastByte = now;
+  if (Serial.available() == 0)
+    catQuiet = now;
+  return b;
+}
+
+/**
+ * The replies go out through a ring that is moved into the serial port as it
+ * has room, a reply never waits for the uart (HardwareSerial's interrupt
+ * sends its own buffer). A frame is only answered when the ring has room for
+ * the longest reply, otherwise it waits in the queue for the ring to drain.
+ * The replies held back that way, and those dropped because they didn't fit
+ * anyway, are counted and read with the private command 0xD4.
+ */
+#define CAT_TX_SIZE 32  // a power of two
+#define CAT_REPLY_MAX 8 // the longest reply, 0xD4
+static uint8_t catTx[CAT_TX_SIZE];
+static uint8_t catTxHead = 0; // bytes queued, it wraps
+static uint8_t catTxTail = 0; // bytes sent
+static bool catHeld = false;  // the frame at the head of the queue has been counted as delayed
+static uint16_t catDelayed = 0;
+static uint16_t catDropped = 0;
+
+static uint8_t catTxFree()
+{
+  return CAT_TX_SIZE - (uint8_t)(catTxHead - catTxTail);
+}
+
+static void catDrain()
+{
+  while (catTxTail != catTxHead && Serial.availableForWrite() > 0)
+    Serial.write(catTx[catTxTail++ % CAT_TX_SIZE]);
+}
+
+// a reply goes out whole or not at all
+static void catSend(const uint8_t *buf, uint8_t len)
+{
+  if (catTxFree() < len)
+  {
+    catDropped++;
+    return;
+  }
+  while (len--)
+    catTx[catTxHead++ % CAT_TX_SIZE] = *buf++;
+  catDrain();
+}
+
+// waits for the ring to empty, before the long diagnostic replies that go straight to the port
+static void catFlush()
+{
+  while (catTxTail != catTxHead)
+    catDrain();
+}
+
+/**
+ * Push mode (auto information)
+ *
+ * Loggers poll the frequency (0x03) and the tx status (0xF7) several times a
+ * second, even when nothing changes. With push mode on (private command 0xD6,
+ * P1 = 1 on, 0 off) the radio sends these itself when they change instead,
+ * and a bridge on the computer (tools/cat_push_bridge.py) answers the polls.
+ *
+ * A push is 0xFE 0xFE, the command it answers and the same bytes the command
+ * would return: 0xFE 0xFE 0x03 followed by 5 bytes, or 0xFE 0xFE 0xF7 followed
+ * by 1 byte. 0xFE never shows up in a frequency or a status, so the bridge can
+ * pick the pushes out of the replies. Changes that come quicker than
+ * CAT_PUSH_INTERVAL are merged, only the latest state goes out.
+ */
+#define CAT_PUSH_INTERVAL 100 // msecs
+#define CAT_PUSH_MAX 8        // the longest push
+static bool catPushOn = false;
+static bool catPushDirty = false;
+static uint32_t catPushTime = 0;
+static uint8_t catPushedFreq[5]; // what the bridge was told last
+static uint8_t catPushedStatus = 0;
+
+/**
+ * The replies to the frequent polls are kept ready made: the frequency and
+ * mode (0x03), the tx status (0xF7) and the last few EEPROM words (0xBB).
+ * Each is tagged with the state version it was made from, and the version
+ * moves on whenever catStateChanged() is called, so a stale reply is never
+ * used. Answering a poll is then a copy into the transmit ring. (0xE7 is a
+ * constant anyway.)
+ *
+ * Measured on the host (tests/test_cat.cpp) only the EEPROM words gain much,
+ * a lookup in the FT-817 image takes twice as long as a cached word. The
+ * frequency comes from bcd_sync(), which keeps the BCD up to date already,
+ * and the status is a few shifts, so those two are about as quick either way.
+ */
+#define CAT_CACHE_WORDS 4
+
+typedef struct
+{
+  uint16_t address;
+  uint16_t version;
+  uint8_t data[2];
+} catCache_t;
+
+static uint16_t catVersion = 1; // 0 is never current, an empty cache entry has version 0
+static uint16_t catCacheFreqVersion = 0;
+static uint8_t catCacheFreq[5];
+static uint16_t catCacheStatusVersion = 0;
+static uint8_t catCacheStatus;
+static catCache_t catCacheEeprom[CAT_CACHE_WORDS];
+static uint8_t catCacheNext = 0; // the entry that goes next
+
+// fills in the reply to 0x03, the frequency and the mode
+static void catFreqMode(uint8_t *response)
+{
+  if (catCacheFreqVersion != catVersion)
+  {
+    writeFreq(catCacheFreq); // Put the frequency into the buffer
+    if (settings.isUSB)
+      catCacheFreq[4] = 0x01; // USB
+    else
+      catCacheFreq[4] = 0x00; // LSB
+    catCacheFreqVersion = catVersion;
+  }
+  memcpy(response, catCacheFreq, 5);
+}
+
+// the reply to 0xF7, the tx status
+static uint8_t catTxStatus()
+{
+  if (catCacheStatusVersion == catVersion)
+    return catCacheStatus;
+
+  bool isHighSWR = false;
+  bool isSplitOn = false;
+
+  /*
+    Inverted -> *ptt = ((p->tx_status & 0x80) == 0); <-- souce code in ft817.c (hamlib)
+  */
+  catCacheStatus = ((settings.inTx ? 0 : 1) << 7) +
+                   ((isHighSWR ? 1 : 0) << 6) + // hi swr off / on
+                   ((isSplitOn ? 1 : 0) << 5) + // Split on / off
+                   (0 << 4) +                   // dummy data
+                   0x08;                        // P0 meter data
+  catCacheStatusVersion = catVersion;
+  return catCacheStatus;
+}
+
+/**
+ * Called wherever the frequency, the mode, the tx status or a setting the
+ * CAT reports may have changed. It only makes a note, the push goes out from
+ * checkCAT() and the cached replies are made again when they are asked for.
+ */
+void catStateChanged()
+{
+  catPushDirty = true;
+  if (++catVersion == 0)
+  { // wrapped, an old entry could carry the new version, so empty them all
+    catVersion = 1;
+    catCacheFreqVersion = 0;
+    catCacheStatusVersion = 0;
+    for (uint8_t i = 0; i < CAT_CACHE_WORDS; i++)
+      catCacheEeprom[i].version = 0;
+  }
+}
+
+static void catPush()
+{
+  uint8_t frame[CAT_PUSH_MAX] = {0xFE, 0xFE};
+
+  if (!catPushOn || !catPushDirty || millis() - catPushTime < CAT_PUSH_INTERVAL)
+    return;
+  if (catTxFree() < 2 * CAT_PUSH_MAX)
+    return; // try again when the replies have gone out
+  catPushDirty = false;
+  catPushTime = millis();
+
+  catFreqMode(frame + 3);
+  if (memcmp(frame + 3, catPushedFreq, 5))
+  {
+    memcpy(catPushedFreq, frame + 3, 5);
+    frame[2] = 0x03;
+    catSend(frame, 8);
+  }
+
+  frame[3] = catTxStatus();
+  if (frame[3] != catPushedStatus)
+  {
+    catPushedStatus = frame[3];
+    frame[2] = 0xF7;
+    catSend(frame, 4);
+  }
+}
 
-// for broken protocol
-#define CAT_RECEIVE_TIMEOUT 500
+/**
+ * The CAT trace
+ *
+ * The last few commands are kept with the time they came in, how long they
+ * took to answer and the length of the reply. The private command 0xD5 reads
+ * them (P1 = 1 clears them). The reply is the number of entries, then the
+ * entries oldest first, 10 bytes each, little endian:
+ *   2 bytes  msecs when the command was taken up (the low 16 bits of millis())
+ *   5 bytes  the command as received, P1 to P4 and the opcode
+ *   2 bytes  usecs to answer it, it stops at 65535
+ *   1 byte   bytes in the reply
+ *
+ * On the display only the last character of the top line shows CAT activity,
+ * and it changes at most every CAT_BLINK msecs.
+ */
+#define CAT_TRACE_SIZE 8
+#define CAT_BLINK 250
+
+typedef struct
+{
+  uint16_t time;
+  uint8_t cmd[5];
+  uint16_t usecs;
+  uint8_t replyLen;
+} catTrace_t;
+
+static catTrace_t catTrace[CAT_TRACE_SIZE];
+static uint8_t catTraceNext = 0;
+static uint8_t catTraceCount = 0;
+static bool catActive = false; // commands came in since the indicator last changed
+static bool catLit = false;
+static uint32_t catBlinkTime = 0;
+
+static void catTraceSend()
+{
+  uint8_t i = (catTraceNext + CAT_TRACE_SIZE - catTraceCount) % CAT_TRACE_SIZE;
+
+  Serial.write(catTraceCount);
+  for (uint8_t n = 0; n < catTraceCount; n++, i = (i + 1) % CAT_TRACE_SIZE)
+  {
+    Serial.write((uint8_t)catTrace[i].time);
+    Serial.write((uint8_t)(catTrace[i].time >> 8));
+    Serial.write(catTrace[i].cmd, 5);
+    Serial.write((uint8_t)catTrace[i].usecs);
+    Serial.write((uint8_t)(catTrace[i].usecs >> 8));
+    Serial.write(catTrace[i].replyLen);
+  }
+}
+
+// answers a command and keeps it in the trace
+static void catProcess()
+{
+  catTrace_t *t = &catTrace[catTraceNext];
+  uint8_t txHead = catTxHead;
+  uint32_t start = micros();
+
+  t->time = millis();
+  memcpy(t->cmd, cat, 5);
+
+  processCATCommand2(cat);
+
+  uint32_t usecs = micros() - start;
+  t->usecs = usecs > 0xFFFF ? 0xFFFF : usecs;
+  t->replyLen = catTxHead - txHead;
+  catTraceNext = (catTraceNext + 1) % CAT_TRACE_SIZE;
+  if (catTraceCount < CAT_TRACE_SIZE)
+    catTraceCount++;
+  catActive = true;
+}
+
+// lights the indicator when commands come in and puts it out when they stop
+static void catBlink()
+{
+  if (millis() - catBlinkTime < CAT_BLINK || catActive == catLit)
+  {
+    if (catActive && catLit)
+    { // still busy, keep it lit
+      catActive = false;
+      catBlinkTime = millis();
+    }
+    return;
+  }
+
+  catLit = catActive;
+  catActive = false;
+  catBlinkTime = millis();
+  printActivity(catLit);
+}
+
+/**
+ * Streaming mode
+ *
+ * Panadapters and doppler programs retune many times a second. Turned on
+ * with the private command 0xD7 (P1 = 1, P2 = 1 for acks), the radio stops
+ * reading FT-817 commands and takes frequency frames instead:
+ *   0xA5, sequence number, frequency in hz (4 bytes, little endian), checksum
+ * where the checksum is the sum of the five bytes after 0xA5. A frame with a
+ * frequency of 0 goes back to FT-817 commands.
+ *
+ * Only the latest frequency matters: a frame that comes in before the one
+ * before it was applied replaces it, and the display follows at most every
+ * CAT_STREAM_DISPLAY msecs. With acks on, the radio sends 0xA5 and the
+ * sequence number of the last frequency applied, at most every
+ * CAT_STREAM_ACK msecs, which acknowledges all the frames up to it.
+ * The frames that were replaced or had a bad checksum are counted in 0xD4.
+ */
+#define CAT_STREAM_SYNC 0xA5
+#define CAT_STREAM_FRAME 7
+#define CAT_STREAM_DISPLAY 100 // msecs
+#define CAT_STREAM_ACK 20      // msecs
+static bool catStreaming = false;
+static bool catStreamAcks = false;
+static bool catStreamPending = false; // a frequency waits to be applied
+static bool catStreamShow = false;    // the display is behind
+static bool catStreamUnacked = false;
+static uint32_t catStreamTarget;
+static uint8_t catStreamSeq;     // of the frequency waiting
+static uint8_t catStreamApplied; // of the last one applied
+static uint32_t catStreamShown = 0;
+static uint32_t catStreamAcked = 0;
+static uint16_t catStreamReplaced = 0;
+static uint16_t catStreamBad = 0;
+
+static void catStreamReceive(uint32_t now)
+{
+  while (catStreaming && Serial.available() > 0)
+  {
+    uint8_t b = catReadByte(now);
+    if (catFill == 0 && b != CAT_STREAM_SYNC)
+      continue; // looking for the start of a frame
+    catFrame[catFill++] = b;
+    if (catFill < CAT_STREAM_FRAME)
+      continue;
+    catFill = 0;
+
+    uint8_t sum = 0;
+    for (uint8_t i = 1; i < 6; i++)
+      sum += catFrame[i];
+    if (sum != catFrame[6])
+    {
+      catStreamBad++;
+      continue;
+    }
+
+    uint32_t f = (uint32_t)catFrame[5] << 24 | (uint32_t)catFrame[4] << 16 | (uint16_t)catFrame[3] << 8 | catFrame[2];
+    if (f == 0)
+    { // the rest are FT-817 commands again
+      catStreaming = false;
+      break;
+    }
+    if (catStreamPending)
+      catStreamReplaced++;
+    catStreamTarget = f;
+    catStreamSeq = catFrame[1];
+    catStreamPending = true;
+  }
+}
+
+// applies the latest frequency, keeps the display up with it and acks
+static void catStreamApply()
+{
+  if (catStreamPending && !settings.inTx)
+  {
+    catStreamPending = false;
+    if (catStreamTarget < LOWEST_FREQ)
+      catStreamTarget = LOWEST_FREQ;
+    if (catStreamTarget > HIGHEST_FREQ)
+      catStreamTarget = HIGHEST_FREQ;
+    setFrequency(catStreamTarget);
+    catStreamApplied = catStreamSeq;
+    catStreamShow = true;
+    catStreamUnacked = catStreamAcks;
+  }
+
+  if (catStreamShow && millis() - catStreamShown >= CAT_STREAM_DISPLAY)
+  {
+    catStreamShow = false;
+    catStreamShown = millis();
+    updateDisplay();
+  }
+
+  if (catStreamUnacked && millis() - catStreamAcked >= CAT_STREAM_ACK && catTxFree() >= 2)
+  {
+    uint8_t ack[2] = {CAT_STREAM_SYNC, catStreamApplied};
+    catStreamUnacked = false;
+    catStreamAcked = millis();
+    catSend(ack, 2);
+  }
+}
 
 #define CAT_MODE_LSB 0x00
 #define CAT_MODE_USB 0x01
@@ -54,35 +458,13 @@ uint8_t getLowNibble(uint8_t b)
 // Takes a number and produces the requested number of decimal digits, staring
 // from the least significant digit.
 //
-void getDecimalDigits(uint32_t number, uint8_t *result, int digits)
-{
-  for (int i = 0; i < digits; i++)
-  {
-    // "Mask off" (in a decimal sense) the LSD and return it
-    result[i] = number % 10;
-    // "Shift right" (in a decimal sense)
-    number /= 10;
-  }
-}
-
-// Takes a frequency and writes it into the CAT command buffer in BCD form.
+// Writes the current frequency into the CAT command buffer in BCD form.
+// The BCD copy of the frequency is already packed the way the protocol
+// wants it, up to 999 MHz and without the 1's place.
 //
-void writeFreq(uint32_t freq, uint8_t *cmd)
-{
-  // Convert the frequency to a set of decimal digits. We are taking 9 digits
-  // so that we can get up to 999 MHz. But the protocol doesn't care about the
-  // LSD (1's place), so we ignore that digit.
-  uint8_t digits[9];
-  getDecimalDigits(freq, digits, 9);
-  // Start from the LSB and get each nibble
-  cmd[3] = setLowNibble(cmd[3], digits[1]);
-  cmd[3] = setHighNibble(cmd[3], digits[2]);
-  cmd[2] = setLowNibble(cmd[2], digits[3]);
-  cmd[2] = setHighNibble(cmd[2], digits[4]);
-  cmd[1] = setLowNibble(cmd[1], digits[5]);
-  cmd[1] = setHighNibble(cmd[1], digits[6]);
-  cmd[0] = setLowNibble(cmd[0], digits[7]);
-  cmd[0] = setHighNibble(cmd[0], digits[8]);
+void writeFreq(uint8_t *cmd)
+{
+  memcpy(cmd, bcd_sync(), 4);
 }
 
 // This function takes a frquency that is encoded using 4 uint8_ts of BCD
@@ -111,166 +493,222 @@ uint32_t readFreq(uint8_t *cmd)
          (uint32_t)d0 * 10L;
 }
 
-// void ReadEEPRom_FT817(uint8_t fromType)
-void catReadEEPRom(void)
+/**
+ * FT-817 EEPROM emulation (command 0xBB)
+ *
+ * Programs read the FT-817's EEPROM to learn its settings, often a long range
+ * of it when they connect. The settings area (0x40 to 0x7C) is kept as an
+ * image in flash with the values of a radio in its factory state, and a
+ * list of descriptors lays the live values (the vfo in use, the bands, the
+ * mode, split and the cw settings) over it, each at its bit position. The
+ * list is sorted by address and searched by halving. A few bytes outside
+ * the settings area that programs are known to read (HRD and fldigi among
+ * them) have fixed values in ft817Bytes. Everything else reads as 0, the
+ * uBITX has no memories and doesn't keep the per band vfo records.
+ * See http://www.ka7oei.com/ft817_memmap.html for the map.
+ */
+#define FT817_IMAGE_START 0x40
+
+const uint8_t ft817Image[] PROGMEM = {
+    // 0x40
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 0x50
+    0x00, 0x00, 0x00, 0x00, 0x00,
+    0x80, // 0x55 7: vfo (not memory), 0: vfo a/b
+    0x00,
+    0xC0, // 0x57 agc off
+    0x40, // 0x58
+    0x00, // 0x59 3-0: vfo a band, 7-4: vfo b band
+    0x00, 0x00,
+    0xB2, // 0x5C beep volume
+    0x42, // 0x5D
+    0x00, // 0x5E 3-0: cw pitch
+    0x32, // 0x5F
+    // 0x60
+    0x00, // 0x60 cw delay in 10 msec
+    0x32, // 0x61 6-0: sidetone volume, the uBITX has none, this is the factory 50
+    0x00, // 0x62 5-0: cw speed - 4 wpm
+    0xB2, // 0x63 vox gain
+    0xA5, // 0x64
+    0x00, 0x00,
+    0xB2, // 0x67 ssb mic
+    0xB2, // 0x68
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 0x70
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, // 0x78 7-5: mode
+    0x00, // 0x79 tx power high
+    0x7F, // 0x7A 7: split, 6-0: rear antennas
+    0x00, 0x00};
+
+// bytes outside the image, sorted by address
+typedef struct
 {
-  // for remove warnings
-  uint8_t temp0 = cat[0];
-  uint8_t temp1 = cat[1];
-  /*
-    itoa((int) cat[0], b, 16);
-    strcat(b, ":");
-    itoa((int) cat[1], c, 16);
-    strcat(b, c);
-    printLine2(b);
-  */
+  uint16_t address;
+  uint8_t value;
+} ft817Byte_t;
 
-  cat[0] = 0;
-  cat[1] = 0;
-  // for remove warnings[1] = 0;
+const ft817Byte_t ft817Bytes[] PROGMEM = {
+    {0x00B3, 0x00},
+    {0x00B4, 0x4D},
+    {0x0345, 0x00},
+    {0x0346, 0xD0},
+    {0x0347, 0xDC},
+    {0x0348, 0xE0}};
 
-  switch (temp1)
+#define FT817_BYTES (sizeof(ft817Bytes) / sizeof(ft817Bytes[0]))
+
+enum
+{
+  FT817_VFO_B,
+  FT817_BAND_A,
+  FT817_BAND_B,
+  FT817_PITCH,
+  FT817_DELAY,
+  FT817_SPEED,
+  FT817_MODE,
+  FT817_SPLIT
+};
+
+typedef struct
+{
+  uint16_t address;
+  uint8_t field;
+  uint8_t shift; // lowest bit of the field
+  uint8_t mask;  // the field's bits, before the shift
+} ft817Field_t;
+
+// sorted by address
+const ft817Field_t ft817Fields[] PROGMEM = {
+    {0x55, FT817_VFO_B, 0, 0x01},
+    {0x59, FT817_BAND_A, 0, 0x0F},
+    {0x59, FT817_BAND_B, 4, 0x0F},
+    {0x5E, FT817_PITCH, 0, 0x0F},
+    {0x60, FT817_DELAY, 0, 0xFF},
+    {0x62, FT817_SPEED, 0, 0x3F},
+    {0x78, FT817_MODE, 5, 0x07},
+    {0x7A, FT817_SPLIT, 7, 0x01}};
+
+#define FT817_FIELDS (sizeof(ft817Fields) / sizeof(ft817Fields[0]))
+
+// upper edges in khz of the FT-817 bands the uBITX covers, 160m to 12m, the rest is 10m
+const uint16_t ft817Bands[] PROGMEM = {3000, 5500, 8500, 12000, 16000, 19500, 23000, 26500};
+
+static uint8_t ft817Band(uint32_t frequency)
+{
+  uint8_t band = 0;
+
+  while (band < sizeof(ft817Bands) / sizeof(ft817Bands[0]) &&
+         frequency / 1000 >= pgm_read_word(&ft817Bands[band]))
+    band++;
+  return band;
+}
+
+static uint8_t ft817Value(uint8_t field)
+{
+  int value;
+
+  switch (field)
   {
-  case 0x45: //
-    if (temp0 == 0x03)
-    {
-      cat[0] = 0x00;
-      cat[1] = 0xD0;
-    }
-    break;
-  case 0x47: //
-    if (temp0 == 0x03)
-    {
-      cat[0] = 0xDC;
-      cat[1] = 0xE0;
-    }
-    break;
-  case 0x55:
-    // 0 : VFO A/B  0 = VFO-A, 1 = VFO-B
-    // 1 : MTQMB Select  0 = (Not MTQMB), 1 = MTQMB ("Memory Tune Quick Memory Bank")
-    // 2 : QMB Select  0 = (Not QMB), 1 = QMB  ("Quick Memory Bank")
-    // 3 :
-    // 4 : Home Select  0 = (Not HOME), 1 = HOME memory
-    // 5 : Memory/MTUNE select  0 = Memory, 1 = MTUNE
-    // 6 :
-    // 7 : MEM/VFO Select  0 = Memory, 1 = VFO (A or B - see bit 0)
-    cat[0] = 0x80 + (settings.vfoActive == VFO_B ? 1 : 0);
-    cat[1] = 0x00;
-    break;
-  case 0x57: //
-    // 0 : 1-0  AGC Mode  00 = Auto, 01 = Fast, 10 = Slow, 11 = Off
-    // 2  DSP On/Off  0 = Off, 1 = On  (Display format)
-    // 4  PBT On/Off  0 = Off, 1 = On  (Passband Tuning)
-    // 5  NB On/Off 0 = Off, 1 = On  (Noise Blanker)
-    // 6  Lock On/Off 0 = Off, 1 = On  (Dial Lock)
-    // 7  FST (Fast Tuning) On/Off  0 = Off, 1 = On  (Fast tuning)
-
-    cat[0] = 0xC0;
-    cat[1] = 0x40;
-    break;
-  case 0x59: //  band select VFO A Band Select  0000 = 160 M, 0001 = 75 M, 0010 = 40 M, 0011 = 30 M, 0100 = 20 M, 0101 = 17 M, 0110 = 15 M, 0111 = 12 M, 1000 = 10 M, 1001 = 6 M, 1010 = FM BCB, 1011 = Air, 1100 = 2 M, 1101 = UHF, 1110 = (Phantom)
-    // http://www.ka7oei.com/ft817_memmap.html
-    // CAT_BUFF[0] = 0xC2;
-    // CAT_BUFF[1] = 0x82;
-    break;
-  case 0x5C: // Beep Volume (0-100) (#13)
-    cat[0] = 0xB2;
-    cat[1] = 0x42;
-    break;
-  case 0x5E:
-    // 3-0 : CW Pitch (300-1000 Hz) (#20)  From 0 to E (HEX) with 0 = 300 Hz and each step representing 50 Hz
-    // 5-4 :  Lock Mode (#32) 00 = Dial, 01 = Freq, 10 = Panel
-    // 7-6 :  Op Filter (#38) 00 = Off, 01 = SSB, 10 = CW
-    // CAT_BUFF[0] = 0x08;
-    cat[0] = (settings.sideTone - 300) / 50;
-    cat[1] = 0x25;
-    break;
-  case 0x61: // settings.Sidetone (Volume) (#44)
-    cat[0] = settings.sideTone % 50;
-    cat[1] = 0x08;
-    break;
-  case 0x5F: //
-    // 4-0  CW Weight (1.:2.5-1:4.5) (#22)  From 0 to 14 (HEX) with 0 = 1:2.5, incrementing in 0.1 weight steps
-    // 5  420 ARS (#2)  0 = Off, 1 = On
-    // 6  144 ARS (#1)  0 = Off, 1 = On
-    // 7  Sql/RF-G (#45)  0 = Off, 1 = On
-    cat[0] = 0x32;
-    cat[1] = 0x08;
-    break;
-  case 0x60: // CW Delay (10-2500 ms) (#17)  From 1 to 250 (decimal) with each step representing 10 ms
-    cat[0] = settings.cwDelayTime;
-    cat[1] = 0x32;
-    break;
-  case 0x62: //
-    // 5-0  CW Speed (4-60 WPM) (#21) From 0 to 38 (HEX) with 0 = 4 WPM and 38 = 60 WPM (1 WPM steps)
-    // 7-6  Batt-Chg (6/8/10 Hours (#11)  00 = 6 Hours, 01 = 8 Hours, 10 = 10 Hours
-    // CAT_BUFF[0] = 0x08;
-    cat[0] = 1200 / settings.cwSpeed - 4;
-    cat[1] = 0xB2;
-    break;
-  case 0x63: //
-    // 6-0  VOX Gain (#51)  Contains 1-100 (decimal) as displayed
-    // 7  Disable AM/FM Dial (#4) 0 = Enable, 1 = Disable
-    cat[0] = 0xB2;
-    cat[1] = 0xA5;
-    break;
-  case 0x64: //
-    break;
-  case 0x67: // 6-0  SSB Mic (#46) Contains 0-100 (decimal) as displayed
-    cat[0] = 0xB2;
-    cat[1] = 0xB2;
-    break;
-  case 0x69: // FM Mic (#29)  Contains 0-100 (decimal) as displayed
-  case 0x78:
-    if (settings.isUSB)
-      cat[0] = CAT_MODE_USB;
+  case FT817_VFO_B:
+    return settings.vfoActive == VFO_B;
+  case FT817_BAND_A:
+    return ft817Band(settings.vfoA);
+  case FT817_BAND_B:
+    return ft817Band(settings.vfoB);
+  case FT817_PITCH: // 300 to 1000 hz in 50 hz steps
+    value = ((int)settings.sideTone - 300) / 50;
+    return value < 0 ? 0 : value > 14 ? 14 : value;
+  case FT817_DELAY: // 10 to 2500 msecs in 10 msec steps
+    return settings.cwDelayTime < 1 ? 1 : settings.cwDelayTime > 250 ? 250 : settings.cwDelayTime;
+  case FT817_SPEED: // 4 to 60 wpm
+    value = 1200 / settings.cwSpeed - 4;
+    return value < 0 ? 0 : value > 56 ? 56 : value;
+  case FT817_MODE:
+    return settings.isUSB ? CAT_MODE_USB : CAT_MODE_LSB;
+  case FT817_SPLIT:
+    return settings.splitOn;
+  }
+  return 0;
+}
+
+static uint8_t ft817Read(uint16_t address)
+{
+  uint8_t b = 0;
+  uint8_t lo = 0, hi = FT817_FIELDS;
+
+  if (address >= FT817_IMAGE_START && address < FT817_IMAGE_START + sizeof(ft817Image))
+    b = pgm_read_byte(&ft817Image[address - FT817_IMAGE_START]);
+  else
+  {
+    for (uint8_t i = 0; i < FT817_BYTES && pgm_read_word(&ft817Bytes[i].address) <= address; i++)
+      if (pgm_read_word(&ft817Bytes[i].address) == address)
+        b = pgm_read_byte(&ft817Bytes[i].value);
+  }
+
+  // the first descriptor at the address or past it
+  while (lo < hi)
+  {
+    uint8_t mid = (lo + hi) / 2;
+    if (pgm_read_word(&ft817Fields[mid].address) < address)
+      lo = mid + 1;
     else
-      cat[0] = CAT_MODE_LSB;
+      hi = mid;
+  }
 
-    if (cat[0] != 0)
-      cat[0] = 1 << 5;
-    break;
-  case 0x79: //
-    // 1-0  TX Power (All bands)  00 = High, 01 = L3, 10 = L2, 11 = L1
-    // 3  PRI On/Off  0 = Off, 1 = On
-    // DW On/Off  0 = Off, 1 = On
-    // SCN (Scan) Mode  00 = No scan, 10 = Scan up, 11 = Scan down
-    // ART On/Off  0 = Off, 1 = On
-    cat[0] = 0x00;
-    cat[1] = 0x00;
-    break;
-  case 0x7A: // SPLIT
-    // 7A  0 HF Antenna Select 0 = Front, 1 = Rear
-    // 7A  1 6 M Antenna Select  0 = Front, 1 = Rear
-    // 7A  2 FM BCB Antenna Select 0 = Front, 1 = Rear
-    // 7A  3 Air Antenna Select  0 = Front, 1 = Rear
-    // 7A  4 2 M Antenna Select  0 = Front, 1 = Rear
-    // 7A  5 UHF Antenna Select  0 = Front, 1 = Rear
-    // 7A  6 ? ?
-    // 7A  7 SPL On/Off  0 = Off, 1 = On
-
-    cat[0] = (settings.splitOn ? 0xFF : 0x7F);
-    break;
-  case 0xB3: //
-    cat[0] = 0x00;
-    cat[1] = 0x4D;
-    break;
+  for (; lo < FT817_FIELDS && pgm_read_word(&ft817Fields[lo].address) == address; lo++)
+  {
+    uint8_t shift = pgm_read_byte(&ft817Fields[lo].shift);
+    uint8_t mask = pgm_read_byte(&ft817Fields[lo].mask);
+    b = (b & ~(mask << shift)) | ((ft817Value(pgm_read_byte(&ft817Fields[lo].field)) & mask) << shift);
+  }
+  return b;
+}
+
+// works out the two bytes at the address in cat[0], cat[1] and puts them in their place
+static void catEepromWord(void)
+{
+  uint16_t address = (uint16_t)cat[0] << 8 | cat[1];
+
+  cat[0] = ft817Read(address);
+  cat[1] = ft817Read(address + 1);
+}
+
+void catReadEEPRom(void)
+{
+  uint16_t address = (uint16_t)cat[0] << 8 | cat[1];
+  catCache_t *c = catCacheEeprom;
+
+  for (uint8_t i = 0; i < CAT_CACHE_WORDS; i++, c++)
+    if (c->version == catVersion && c->address == address)
+      break;
+
+  if (c == catCacheEeprom + CAT_CACHE_WORDS)
+  { // not there, work it out in the place of the oldest one
+    c = catCacheEeprom + catCacheNext;
+    catCacheNext = (catCacheNext + 1) % CAT_CACHE_WORDS;
+    catEepromWord();
+    c->address = address;
+    c->version = catVersion;
+    memcpy(c->data, cat, 2);
   }
 
   // sent the data
-  Serial.write(cat, 2);
+  catSend(c->data, 2);
 }
 
 void processCATCommand2(uint8_t *cmd)
 {
-  uint8_t response[5];
+  uint8_t response[8];
   uint32_t f;
 
+  TRACE(TR_CAT, cmd[4]);
+  catLastOpcode = cmd[4];
   switch (cmd[4])
   {
     /*  case 0x00:
         response[0]=0;
-        Serial.write(response, 1);
+        catSend(response, 1);
         break;
     */
   case 0x01:
@@ -279,7 +717,7 @@ void processCATCommand2(uint8_t *cmd)
     setFrequency(f);
     updateDisplay();
     response[0] = 0;
-    Serial.write(response, 1);
+    catSend(response, 1);
     // sprintf(b, "set:%ld", f);
     // printLine2(b);
     break;
@@ -287,19 +725,17 @@ void processCATCommand2(uint8_t *cmd)
   case 0x02:
     // split on
     settings.splitOn = true;
+    catStateChanged();
     break;
   case 0x82:
     // split off
     settings.splitOn = false;
+    catStateChanged();
     break;
 
   case 0x03:
-    writeFreq(settings.frequency, response); // Put the frequency into the buffer
-    if (settings.isUSB)
-      response[4] = 0x01; // USB
-    else
-      response[4] = 0x00; // LSB
-    Serial.write(response, 5);
+    catFreqMode(response);
+    catSend(response, 5);
     // printLine2("cat:getfreq");
     break;
 
@@ -309,7 +745,7 @@ void processCATCommand2(uint8_t *cmd)
     else
       settings.isUSB = 1;
     response[0] = 0x00;
-    Serial.write(response, 1);
+    catSend(response, 1);
     setFrequency(settings.frequency);
     // printLine2("cat: mode changed");
     // updateDisplay();
@@ -327,7 +763,7 @@ void processCATCommand2(uint8_t *cmd)
     {
       response[0] = 0xf0;
     }
-    Serial.write(response, 1);
+    catSend(response, 1);
     updateDisplay();
     break;
 
@@ -338,7 +774,7 @@ void processCATCommand2(uint8_t *cmd)
       settings.txCAT = false;
     }
     response[0] = 0;
-    Serial.write(response, 1);
+    catSend(response, 1);
     updateDisplay();
     break;
 
@@ -346,7 +782,7 @@ void processCATCommand2(uint8_t *cmd)
     // toggle the VFOs
     response[0] = 0;
     menuVfoToggle(1); // '1' forces it to change the VFO
-    Serial.write(response, 1);
+    catSend(response, 1);
     updateDisplay();
     break;
 
@@ -354,97 +790,166 @@ void processCATCommand2(uint8_t *cmd)
     catReadEEPRom();
     break;
 
+  case 0xD0: // not an FT-817 command, the loop time statistics, P1 = 1 clears them
+    catFlush();
+    loopStatsSend();
+    if (cmd[0] == 1)
+      loopStatsReset();
+    break;
+
+  case 0xD1: // not an FT-817 command, the section profiler, P1 = 1 clears it
+    catFlush();
+    profileSend();
+    if (cmd[0] == 1)
+      profileReset();
+    break;
+
+  case 0xD2: // not an FT-817 command, the event trace, P1 = 1 clears it
+    catFlush();
+    traceSend();
+    if (cmd[0] == 1)
+      traceReset();
+    break;
+
+  case 0xD3: // not an FT-817 command, the watchdog history, P1 = 1 clears it
+    catFlush();
+    watchdogSend();
+    if (cmd[0] == 1)
+      watchdogReset();
+    break;
+
+  case 0xD4: // not an FT-817 command, replies delayed and dropped, streaming frames replaced and bad, P1 = 1 clears the counts
+    response[0] = catDelayed;
+    response[1] = catDelayed >> 8;
+    response[2] = catDropped;
+    response[3] = catDropped >> 8;
+    response[4] = catStreamReplaced;
+    response[5] = catStreamReplaced >> 8;
+    response[6] = catStreamBad;
+    response[7] = catStreamBad >> 8;
+    catSend(response, 8);
+    if (cmd[0] == 1)
+      catDelayed = catDropped = catStreamReplaced = catStreamBad = 0;
+    break;
+
+  case 0xD7: // not an FT-817 command, streaming mode, P1 = 1 on, P2 = 1 acks
+    response[0] = 0;
+    catSend(response, 1);
+    catStreaming = cmd[0] == 1;
+    catStreamAcks = cmd[1] == 1;
+    catStreamUnacked = false;
+    break;
+
+  case 0xD5: // not an FT-817 command, the CAT trace, P1 = 1 clears it
+    catFlush();
+    catTraceSend();
+    if (cmd[0] == 1)
+      catTraceCount = 0;
+    break;
+
+  case 0xD6: // not an FT-817 command, push mode, P1 = 1 on, 0 off
+    catPushOn = cmd[0] == 1;
+    response[0] = 0;
+    catSend(response, 1);
+    // start the bridge off with the full state
+    memset(catPushedFreq, 0xFF, sizeof(catPushedFreq));
+    catPushedStatus = 0xFF;
+    catPushDirty = true;
+    catPushTime = millis() - CAT_PUSH_INTERVAL;
+    break;
+
   case 0xe7:
     // get receiver status, we have hardcoded this as
     // as we dont' support ctcss, etc.
     response[0] = 0x09;
-    Serial.write(response, 1);
+    catSend(response, 1);
     break;
 
   case 0xf7:
-  {
-    bool isHighSWR = false;
-    bool isSplitOn = false;
-
-    /*
-      Inverted -> *ptt = ((p->tx_status & 0x80) == 0); <-- souce code in ft817.c (hamlib)
-    */
-    response[0] = ((settings.inTx ? 0 : 1) << 7) +
-                  ((isHighSWR ? 1 : 0) << 6) + // hi swr off / on
-                  ((isSplitOn ? 1 : 0) << 5) + // Split on / off
-                  (0 << 4) +                   // dummy data
-                  0x08;                        // P0 meter data
-
-    Serial.write(response, 1);
-  }
-  break;
+    response[0] = catTxStatus();
+    catSend(response, 1);
+    break;
 
   default:
-    // somehow, get this to print the four uint8_ts
-    ultoa(*((uint32_t *)cmd), cBuf, 16);
-    itoa(cmd[4], bBuf, 16);
-    strcat(bBuf, ">");
-    strcat(bBuf, cBuf);
-    printLine2(bBuf);
+    // unknown commands show up in the CAT trace (0xD5)
     response[0] = 0x00;
-    Serial.write(response[0]);
+    catSend(response, 1);
   }
-
-  insideCat = false;
 }
 
-int catCount = 0;
-void checkCAT()
+/**
+ * The CAT frames are taken apart one byte at a time as they come in, so a
+ * frame can arrive over several passes of the loop. The complete frames
+ * wait in a small queue and all of them are answered in the same pass, a
+ * program that sends several commands back to back isn't held up by the
+ * loop. A frame that stops half way (a byte lost on the line) is dropped
+ * after a few character times, the next byte starts a new frame.
+ */
+// receive the bytes waiting on the serial port, as long as there is room in the queue
+static void catReceive()
 {
-  uint8_t i;
+  uint32_t now = millis();
 
-  // Check Serial Port Buffer
   if (Serial.available() == 0)
-  { // Set Buffer Clear status
-    rxBufferCheckCount = 0;
-    return;
+    catQuiet = now;
+  if (catFill > 0 && catGap())
+    catFill = 0;
+
+  if (catStreaming)
+  {
+    catStreamReceive(now);
+    if (catStreaming)
+      return;
+    // it ended, what follows are FT-817 commands
   }
-  else if (Serial.available() < 5)
-  { // First Arrived
-    if (rxBufferCheckCount == 0)
+
+  while (Serial.available() > 0 && (uint8_t)(catHead - catTail) < CAT_QUEUE_SIZE)
+  {
+    uint8_t b = catReadByte(now);
+    catFrame[catFill++] = b;
+    if (catFill == 5)
     {
-      rxBufferCheckCount = Serial.available();
-      rxBufferArriveTime = millis() + CAT_RECEIVE_TIMEOUT; // Set time for timeout
-    }
-    else if (rxBufferArriveTime < millis())
-    { // Clear Buffer
-      for (i = 0; i < Serial.available(); i++)
-        rxBufferCheckCount = Serial.read();
-      rxBufferCheckCount = 0;
-    }
-    else if (rxBufferCheckCount < Serial.available())
-    { // Increase buffer count, slow arrive
-      rxBufferCheckCount = Serial.available();
-      rxBufferArriveTime = millis() + CAT_RECEIVE_TIMEOUT; // Set time for timeout
+      memcpy(catQueue[catHead % CAT_QUEUE_SIZE], catFrame, 5);
+      catHead++;
+      catFill = 0;
+      // what follows may be streaming frames, leave it until this has been answered
+      if (catFrame[4] == 0xD7)
+        break;
     }
-    return;
   }
+}
 
-  // Arived CAT DATA
-  for (i = 0; i < 5; i++)
-    cat[i] = Serial.read();
-
+void checkCAT()
+{
   // this code is not re-entrant.
   if (insideCat == 1)
     return;
   insideCat = 1;
 
-  /**
-   *  This routine is enabled to debug the cat protocol
-   **/
-  catCount++;
-
-  if (cat[4] != 0xf7 && cat[4] != 0xbb && cat[4] != 0x03)
+  catDrain();
+  catReceive();
+  while (catTail != catHead)
   {
-    sprintf(bBuf, "%d %02x %02x%02x%02x%02x", catCount, cat[4], cat[0], cat[1], cat[2], cat[3]);
-    printLine2(bBuf);
-  }
+    // a poll that comes in while the last replies are still going out waits for them
+    if (catTxFree() < CAT_REPLY_MAX)
+    {
+      if (!catHeld)
+        catDelayed++;
+      catHeld = true;
+      break;
+    }
+    catHeld = false;
 
-  processCATCommand2(cat);
+    memcpy(cat, catQueue[catTail % CAT_QUEUE_SIZE], 5);
+    catTail++;
+
+    catProcess();
+
+    // frames that came in while this one was answered
+    catReceive();
+  }
+  catStreamApply();
+  catPush();
+  catBlink();
   insideCat = 0;
 }
@@ -0,0 +1,232 @@
+/**
+ * Run time statistics, readable over the CAT port on a rig in the field
+ *
+ * The time of each pass through loop() is measured with micros() and
+ * counted in a log2 histogram: bucket 0 holds the passes under 2 usecs,
+ * bucket n those from 2^n to 2^(n+1) usecs and the last one everything
+ * from 32 msecs up. The longest pass and the total (for the mean) are kept
+ * as well, in 48 bytes all told.
+ *
+ * The statistics are read with the private CAT command 0xD0, which the
+ * FT-817 doesn't use. With P1 set to 1 they are cleared after the reply.
+ * The reply is 44 bytes, all little endian:
+ *   16 x 2 bytes  histogram counts, they stop at 65535
+ *   4 bytes       longest pass in usecs
+ *   4 bytes       mean pass in usecs
+ *   4 bytes       number of passes in the mean
+ */
+
+#include "global.h"
+
+#define LOOP_BUCKETS 16
+
+static uint16_t loopHist[LOOP_BUCKETS];
+static uint32_t loopMax = 0;
+static uint32_t loopSum = 0;   // usecs
+static uint32_t loopCount = 0; // passes in loopSum
+static uint32_t loopLast = 0;  // micros() at the start of the last pass
+static bool loopStarted = false;
+
+// called at the start of each pass through loop()
+void loopStatsMark()
+{
+  uint32_t now = micros();
+  uint32_t dt = now - loopLast;
+  uint8_t bucket = 0;
+
+  loopLast = now;
+  if (!loopStarted)
+  { // no pass to measure yet
+    loopStarted = true;
+    return;
+  }
+
+  for (uint32_t t = dt >> 1; t && bucket < LOOP_BUCKETS - 1; t >>= 1)
+    bucket++;
+  if (loopHist[bucket] < 0xFFFF)
+    loopHist[bucket]++;
+
+  if (dt > loopMax)
+    loopMax = dt;
+
+  // halve the total and the count rather than let the total overflow, the mean stays the same
+  if (loopSum + dt < loopSum)
+  {
+    loopSum >>= 1;
+    loopCount >>= 1;
+  }
+  loopSum += dt;
+  loopCount++;
+}
+
+void loopStatsReset()
+{
+  memset(loopHist, 0, sizeof(loopHist));
+  loopMax = 0;
+  loopSum = 0;
+  loopCount = 0;
+  loopStarted = false;
+}
+
+static void writeLong(uint32_t v)
+{
+  for (uint8_t i = 0; i < 4; i++, v >>= 8)
+    Serial.write((uint8_t)v);
+}
+
+void loopStatsSend()
+{
+  for (uint8_t i = 0; i < LOOP_BUCKETS; i++)
+  {
+    Serial.write((uint8_t)loopHist[i]);
+    Serial.write((uint8_t)(loopHist[i] >> 8));
+  }
+  writeLong(loopMax);
+  writeLong(loopCount ? loopSum / loopCount : 0);
+  writeLong(loopCount);
+}
+
+/**
+ * The section profiler, see diag.h
+ *
+ * The private CAT command 0xD1 returns the section table, P1 = 1 clears it.
+ * The reply starts with the number of sections (0 when the profiler is not
+ * built in), then for each section, little endian:
+ *   2 bytes  calls, they stop at 65535
+ *   4 bytes  total usecs, it stops at 0xFFFFFFFF
+ *   2 bytes  longest call in usecs, it stops at 65535
+ */
+
+#if PROFILE_SECTIONS
+
+typedef struct
+{
+  uint16_t calls;
+  uint32_t total;
+  uint16_t longest;
+} profile_t;
+
+static profile_t profiles[PROF_COUNT];
+
+void profileAdd(uint8_t id, uint32_t usecs)
+{
+  profile_t *p = &profiles[id];
+
+  if (p->calls < 0xFFFF)
+    p->calls++;
+  p->total = p->total + usecs < p->total ? 0xFFFFFFFF : p->total + usecs;
+  if (usecs > p->longest)
+    p->longest = usecs > 0xFFFF ? 0xFFFF : usecs;
+}
+
+void profileReset()
+{
+  memset(profiles, 0, sizeof(profiles));
+}
+
+void profileSend()
+{
+  Serial.write((uint8_t)PROF_COUNT);
+  for (uint8_t i = 0; i < PROF_COUNT; i++)
+  {
+    Serial.write((uint8_t)profiles[i].calls);
+    Serial.write((uint8_t)(profiles[i].calls >> 8));
+    writeLong(profiles[i].total);
+    Serial.write((uint8_t)profiles[i].longest);
+    Serial.write((uint8_t)(profiles[i].longest >> 8));
+  }
+}
+
+#else
+
+void profileReset()
+{
+}
+
+void profileSend()
+{
+  Serial.write((uint8_t)0);
+}
+
+#endif
+
+/**
+ * The event trace, see diag.h
+ *
+ * Each entry is the time since the entry before it (in 64 usec ticks, it
+ * stops at 65535), the event and its argument. When the ring is full the
+ * oldest entry is dropped.
+ *
+ * The private CAT command 0xD2 returns the trace, P1 = 1 clears it. The
+ * reply is the number of entries (0 when the trace is not built in), then
+ * the entries oldest first, 5 bytes each, little endian:
+ *   2 bytes  ticks since the entry before
+ *   1 byte   event
+ *   2 bytes  argument
+ */
+
+#if TRACE_EVENTS
+
+#define TRACE_SIZE 32
+
+typedef struct
+{
+  uint16_t ticks;
+  uint8_t event;
+  uint16_t arg;
+} trace_t;
+
+static trace_t traceRing[TRACE_SIZE];
+static uint8_t traceNext = 0;  // where the next entry goes
+static uint8_t traceCount = 0;
+static uint32_t traceLast = 0; // time of the last entry, 64 usec ticks
+
+void traceAdd(uint8_t event, uint16_t arg)
+{
+  uint32_t now = micros() >> 6;
+  uint32_t ticks = traceCount ? now - traceLast : 0;
+  trace_t *t = &traceRing[traceNext];
+
+  // the time is kept in 16 bits, anything more than 4 seconds apart is cut short
+  t->ticks = ticks < 0xFFFF ? ticks : 0xFFFF;
+  t->event = event;
+  t->arg = arg;
+  traceLast = now;
+
+  traceNext = (traceNext + 1) % TRACE_SIZE;
+  if (traceCount < TRACE_SIZE)
+    traceCount++;
+}
+
+void traceReset()
+{
+  traceCount = 0;
+}
+
+void traceSend()
+{
+  uint8_t i = (traceNext + TRACE_SIZE - traceCount) % TRACE_SIZE;
+
+  Serial.write(traceCount);
+  for (uint8_t n = 0; n < traceCount; n++, i = (i + 1) % TRACE_SIZE)
+  {
+    Serial.write((uint8_t)traceRing[i].ticks);
+    Serial.write((uint8_t)(traceRing[i].ticks >> 8));
+    Serial.write(traceRing[i].event);
+    Serial.write((uint8_t)traceRing[i].arg);
+    Serial.write((uint8_t)(traceRing[i].arg >> 8));
+  }
+}
+
+#else
+
+void traceReset()
+{
+}
+
+void traceSend()
+{
+  Serial.write((uint8_t)0);
+}
+
+#endif
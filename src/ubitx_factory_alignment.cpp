@@ -26,12 +26,14 @@ void btnWaitForClick()
 
 void factory_alignment()
 {
+  uint8_t held = sched_hold(TASK_RADIO); // the radio belongs to the alignment
 
   calibrateClock();
 
   if (settings.pllCalibration == 0)
   {
     printLine2("Setup Aborted");
+    sched_hold(held);
     return;
   }
 
@@ -47,6 +49,7 @@ void factory_alignment()
   if (usbCarrier == 11994999l)
   {
     printLine2("Setup Aborted");
+    sched_hold(held);
     return;
   }
 
@@ -101,4 +104,5 @@ void factory_alignment()
   settings.isUSB = false;
   setFrequency(7150000l);
   updateDisplay();
+  sched_hold(held);
 }
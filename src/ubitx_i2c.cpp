@@ -0,0 +1,187 @@
+/**
+ * Interrupt driven I2C (TWI) master, it only writes registers as that is
+ * all the Si5351 needs.
+ *
+ * The Wire library blocks the caller until the whole transfer is on the bus.
+ * Here a register write is copied into a queue and the TWI interrupt clocks
+ * it out at 400 khz while the main loop carries on with the keyer and CAT.
+ * Transactions that are queued back to back are chained with a repeated start.
+ * The queue is strictly in order, so a PLL reset queued after the divider
+ * writes still lands after them. Code that must know the chip has been
+ * updated (before keying the carrier, for instance) calls i2cFlush().
+ *
+ * None of the waits is open ended. When the bus doesn't move for
+ * I2C_TIMEOUT_USEC (sda held low, no chip answering) the TWI is reset and
+ * whatever was queued is dropped and counted in i2cErrors.
+ */
+
+#include "global.h"
+#include <util/atomic.h>
+
+#define I2C_FREQ 400000L
+#define I2C_QUEUE_SIZE 64 // power of two, one byte always stays free
+#define I2C_QUEUE_MASK (I2C_QUEUE_SIZE - 1)
+#define I2C_MAX_WRITE (I2C_QUEUE_SIZE - 4) // registers in one write, 60: three bytes go to the header
+#define I2C_TIMEOUT_USEC 5000 // a full queue goes out in 1.5 msecs
+
+// each transaction is queued as: byte count (register + data), address, register, data...
+static uint8_t i2cQueue[I2C_QUEUE_SIZE];
+static volatile uint8_t i2cHead = 0;       // next free byte, only moved by the main loop
+static volatile uint8_t i2cTail = 0;       // next byte to send, only moved by the isr
+static volatile bool i2cRunning = false;   // the isr owns the bus
+static uint8_t i2cLeft = 0;                // bytes left of the transaction on the bus
+volatile uint8_t i2cErrors = 0;            // transactions dropped after a nack or a timeout
+
+// called once from setup(), before anything is queued
+void i2cInit()
+{
+  // setting TWCR under a running transfer would strand the queue
+  i2cFlush();
+
+  // internal pull-ups, the Si5351 breakout has its own as well
+  digitalWrite(SDA, 1);
+  digitalWrite(SCL, 1);
+
+  TWSR = 0; // prescaler 1
+  TWBR = ((F_CPU / I2C_FREQ) - 16) / 2;
+  TWCR = _BV(TWEN);
+}
+
+static uint8_t i2cPop()
+{
+  uint8_t t = i2cTail;
+  uint8_t b = i2cQueue[t];
+  i2cTail = (t + 1) & I2C_QUEUE_MASK;
+  return b;
+}
+
+ISR(TWI_vect)
+{
+  switch (TWSR & 0xF8)
+  {
+  case 0x08: // start sent
+  case 0x10: // repeated start sent
+    i2cLeft = i2cPop();
+    TWDR = i2cPop() << 1; // address and the write bit
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+    return;
+
+  case 0x18: // address acked
+  case 0x28: // data acked
+    if (i2cLeft)
+    {
+      i2cLeft--;
+      TWDR = i2cPop();
+      TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+      return;
+    }
+    break;
+
+  default: // nack or lost arbitration, drop the rest of this transaction
+    i2cErrors++;
+    i2cTail = (i2cTail + i2cLeft) & I2C_QUEUE_MASK;
+    i2cLeft = 0;
+    break;
+  }
+
+  // the transaction is done, chain the next one or release the bus
+  if (i2cTail != i2cHead)
+    TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+  else
+  {
+    TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
+    i2cRunning = false;
+  }
+}
+
+// the bus is stuck: let go of it, drop the queue and start over
+static void i2cReset()
+{
+  TWCR = 0; // the TWI releases the pins and stops interrupting
+  i2cLeft = 0;
+  i2cTail = i2cHead;
+  i2cRunning = false;
+  i2cErrors++;
+  TWCR = _BV(TWEN);
+}
+
+/**
+ * Queues a write of vcnt registers starting at reg and returns at once.
+ * It only waits when the queue has no room for the whole transaction, if
+ * that takes longer than I2C_TIMEOUT_USEC the bus is reset and this write
+ * is dropped too. vcnt is at most I2C_MAX_WRITE.
+ */
+void i2cQueueWrite(uint8_t addr, uint8_t reg, const uint8_t *vals, uint8_t vcnt)
+{
+  PROFILE(PROF_I2C);
+  TRACE(TR_I2C, (uint16_t)reg << 8 | vcnt);
+  uint8_t need = vcnt + 3;
+
+  if (vcnt > I2C_MAX_WRITE)
+  {
+    i2cErrors++;
+    return;
+  }
+
+  // the head is ours, the isr only ever frees more room
+  uint32_t start = micros();
+  while (((i2cTail - i2cHead - 1) & I2C_QUEUE_MASK) < need)
+  {
+    if (micros() - start > I2C_TIMEOUT_USEC)
+    {
+      i2cReset();
+      i2cErrors++; // this one
+      return;
+    }
+  }
+
+  uint8_t h = i2cHead;
+  i2cQueue[h] = vcnt + 1;
+  h = (h + 1) & I2C_QUEUE_MASK;
+  i2cQueue[h] = addr;
+  h = (h + 1) & I2C_QUEUE_MASK;
+  i2cQueue[h] = reg;
+  h = (h + 1) & I2C_QUEUE_MASK;
+  while (vcnt--)
+  {
+    i2cQueue[h] = *vals++;
+    h = (h + 1) & I2C_QUEUE_MASK;
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    i2cHead = h; // publish the whole transaction at once
+    if (!i2cRunning)
+    {
+      i2cRunning = true;
+      uint32_t start = micros();
+      while ((TWCR & _BV(TWSTO)) && micros() - start < I2C_TIMEOUT_USEC) // the previous stop is still on the bus
+        ;
+      TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+    }
+  }
+}
+
+// true while queued writes have not reached the chip yet
+bool i2cBusy()
+{
+  return i2cRunning;
+}
+
+// waits until everything queued so far is on the chip
+void i2cFlush()
+{
+  PROFILE(PROF_I2C);
+  uint32_t start = micros();
+  uint8_t tail = i2cTail;
+  while (i2cRunning)
+  {
+    if (i2cTail != tail)
+    { // still moving
+      tail = i2cTail;
+      start = micros();
+    }
+    else if (micros() - start > I2C_TIMEOUT_USEC)
+      i2cReset();
+  }
+}
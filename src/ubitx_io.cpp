@@ -13,32 +13,95 @@ int simEncRead()
     return ret;
 }
 
-static int enc_prev_state = 3;
-
 /**
- * The A7 And A6 are purely analog lines on the Arduino Nano
- * These need to be pulled up externally using two 10 K resistors
- *
- * There are excellent pages on the Internet about how these encoders work
- * and how they should be used. We have elected to use the simplest way
- * to use these encoders without the complexity of interrupts etc to
- * keep it understandable.
+ * The encoder phases A and B are on A0 and A1, which share the pin change
+ * interrupt of port C (PCINT8 and PCINT9). Every edge runs the isr below, which
+ * looks up the transition from the previous to the new phase state in a Gray
+ * code table and pushes the resulting step, with a timestamp, into a small ring.
+ * Bounces and skipped states decode to no step at all.
  *
- * The enc_state returns a two-bit number such that each bit reflects the current
- * value of each of the two phases of the encoder
+ * The ring has a single producer (the isr) and a single consumer (the main
+ * loop), so neither side needs to block the other: the isr only moves encHead,
+ * the loop only moves encTail. If the loop falls behind and the ring fills up,
+ * the isr adds the step to the newest event instead, so no steps are lost.
  *
- * The enc_read returns the number of net pulses counted over 50 msecs.
- * If the puluses are -ve, they were anti-clockwise, if they are +ve, the
- * were in the clockwise directions. Higher the pulses, greater the speed
- * at which the enccoder was spun
+ * The timestamps are micros()/64, they wrap every 4 seconds which is plenty
+ * to measure the time between two edges of a spinning knob.
  */
 
-static uint8_t enc_state(void)
+#define ENC_RING_SIZE 16 // power of two
+#define ENC_RING_MASK (ENC_RING_SIZE - 1)
+#define ENC_WINDOW 50    // msecs enc_read() counts pulses over
+
+typedef struct
+{
+    int8_t step;
+    uint16_t time;
+} encEvent_t;
+
+static volatile encEvent_t encRing[ENC_RING_SIZE];
+static volatile uint8_t encHead = 0; // only moved by the isr
+static volatile uint8_t encTail = 0; // only moved by the loop
+static uint8_t encLast = 3;          // phase state of the previous edge, isr only
+
+// +1 clockwise, -1 anti-clockwise, indexed by previous state << 2 | new state
+static const int8_t encTable[16] PROGMEM = {
+    0, +1, -1, 0,
+    -1, 0, 0, +1,
+    +1, 0, 0, -1,
+    0, -1, +1, 0};
+
+static int encCount = 0;           // pulses in the current enc_read() window
+static uint32_t encWindowStart = 0;
+
+ISR(PCINT1_vect)
+{
+    uint8_t state = PINC & 0x03; // A0 is bit 0, A1 is bit 1
+    int8_t step = (int8_t)pgm_read_byte(encTable + ((encLast << 2) | state));
+    encLast = state;
+    if (!step)
+        return;
+
+    uint8_t h = encHead;
+    uint8_t next = (h + 1) & ENC_RING_MASK;
+    if (next == encTail)
+    { // full, fold the step into the newest event
+        volatile encEvent_t *e = encRing + ((h - 1) & ENC_RING_MASK);
+        if (e->step > -127 && e->step < 127)
+            e->step += step;
+        return;
+    }
+    encRing[h].step = step;
+    encRing[h].time = (uint16_t)(micros() >> 6);
+    encHead = next;
+}
+
+void enc_init()
+{
+    encLast = PINC & 0x03;
+    PCMSK1 |= _BV(PCINT8) | _BV(PCINT9);
+    PCICR |= _BV(PCIE1);
+}
+
+// takes the oldest encoder event off the ring, false if there is none
+bool enc_pop(int8_t *step, uint16_t *time)
 {
-    HandleSimIo();
-    return (analogRead(PIN_ENC_A) > 500 ? 1 : 0) + (analogRead(PIN_ENC_B) > 500 ? 2 : 0);
+    uint8_t t = encTail;
+    if (t == encHead)
+        return false;
+    *step = encRing[t].step;
+    *time = encRing[t].time;
+    encTail = (t + 1) & ENC_RING_MASK;
+    return true;
 }
 
+/**
+ * The enc_read returns the number of net pulses counted over 50 msecs.
+ * If the puluses are -ve, they were anti-clockwise, if they are +ve, the
+ * were in the clockwise directions. Higher the pulses, greater the speed
+ * at which the enccoder was spun.
+ * It never waits: it drains the ring and returns 0 until the window is over.
+ */
 int enc_read(void)
 {
     if (simulateIO)
@@ -47,58 +110,54 @@ int enc_read(void)
         return simEncRead();
     }
 
-    int result = 0;
-    uint8_t newState;
-    int enc_speed = 0;
-
-    uint32_t stop_by = millis() + 50;
+    int8_t step;
+    uint16_t time;
+    while (enc_pop(&step, &time))
+        encCount += step;
 
-    while (millis() < stop_by)
-    {                           // check if the previous state was stable
-        newState = enc_state(); // Get current state
+    if (millis() - encWindowStart < ENC_WINDOW)
+        return 0;
 
-        if (newState != enc_prev_state)
-            delay(1);
+    int result = encCount;
+    encCount = 0;
+    encWindowStart = millis();
+    return result;
+}
 
-        if (enc_state() != newState || newState == enc_prev_state)
-            continue;
-        // these transitions point to the encoder being rotated anti-clockwise
-        if ((enc_prev_state == 0 && newState == 2) ||
-            (enc_prev_state == 2 && newState == 3) ||
-            (enc_prev_state == 3 && newState == 1) ||
-            (enc_prev_state == 1 && newState == 0))
-        {
-            result--;
-        }
-        // these transitions point o the enccoder being rotated clockwise
-        if ((enc_prev_state == 0 && newState == 1) ||
-            (enc_prev_state == 1 && newState == 3) ||
-            (enc_prev_state == 3 && newState == 2) ||
-            (enc_prev_state == 2 && newState == 0))
-        {
-            result++;
-        }
-        enc_prev_state = newState; // Record state for next pulse interpretation
-        enc_speed++;
-        active_delay(1);
-    }
-    return (result);
+/**
+ * The encoder is read by one loop at a time: the tuning loop, the menu
+ * selection or a menu item. A new reader calls this first, so the turns made
+ * while somebody else was reading don't spill over into it.
+ */
+void enc_reset()
+{
+    int8_t step;
+    uint16_t time;
+    while (enc_pop(&step, &time))
+        ;
+    encCount = 0;
+    encWindowStart = millis();
+    knob_reset();
 }
 
 bool pttOn()
 {
-    HandleSimIo();
     if (simulateIO)
+    {
+        HandleSimIo();
         return simPtt;
+    }
     return digitalRead(PIN_PTT) == LOW;
 }
 
 // returns true if the button is pressed
 bool btnDown()
 {
-    HandleSimIo();
     if (simulateIO)
+    {
+        HandleSimIo();
         return simBtn;
+    }
 
     return digitalRead(PIN_FBUTTON) == LOW;
 }
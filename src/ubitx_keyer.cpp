@@ -54,6 +54,7 @@ static char lastPaddle = 0;
 // reads the analog keyer pin and reports the paddle
 uint8_t getPaddle()
 {
+  PROFILE(PROF_ADC);
   int paddle = analogRead(PIN_ANALOG_KEYER);
 
   if (paddle > 800) // above 4v is up
@@ -76,6 +77,7 @@ uint8_t getPaddle()
  */
 void cwKeydown()
 {
+  TRACE(TR_KEY_DOWN, 0);
   settings.keyDown = 1; // tracks the PIN_CW_KEY
   tone(PIN_CW_TONE, (int)settings.sideTone);
   digitalWrite(PIN_CW_KEY, 1);
@@ -91,6 +93,7 @@ void cwKeydown()
  */
 void cwKeyUp()
 {
+  TRACE(TR_KEY_UP, 0);
   settings.keyDown = 0; // tracks the PIN_CW_KEY
   noTone(PIN_CW_TONE);
   digitalWrite(PIN_CW_KEY, 0);
@@ -123,8 +126,12 @@ unsigned char keyerState = IDLE;
 char update_PaddleLatch(uint8_t isUpdateKeyState)
 {
   unsigned char tmpKeyerControl = 0;
+  int paddle;
 
-  int paddle = analogRead(PIN_ANALOG_KEYER);
+  {
+    PROFILE(PROF_ADC);
+    paddle = analogRead(PIN_ANALOG_KEYER);
+  }
   // diagnostic, VU2ESE
   // itoa(paddle, b, 10);
   // printLine2(b);
@@ -165,6 +172,7 @@ void cwKeyer(void)
   {
     while (continue_loop)
     {
+      watchdogFeed();
       switch (keyerState)
       {
       case IDLE:
@@ -261,13 +269,14 @@ void cwKeyer(void)
         break;
       }
 
-      checkCAT();
+      sched_yield();
     } // end of while
   }
   else
   {
     while (1)
     {
+      watchdogFeed();
       if (update_PaddleLatch(0) == DIT_L)
       {
         // if we are here, it is only because the key is pressed
@@ -305,7 +314,7 @@ void cwKeyer(void)
         return; // Tx stop control by Main Loop
       }
 
-      checkCAT();
+      sched_yield();
     } // end of while
   } // end of elese
 }
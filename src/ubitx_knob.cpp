@@ -0,0 +1,107 @@
+/**
+ * Tuning knob acceleration
+ *
+ * The time between encoder edges (stamped by the encoder interrupt) is run
+ * through a small fixed point filter to get the speed of the knob. The speed
+ * picks the size of the step from a curve kept in PROGMEM, so the same knob
+ * can land on a 10 hz step when turned slowly and cross a band in a single
+ * spin. Each caller brings its own curve: the vfo, the rit and the menu values
+ * all move at different rates, but they share the one knob and its speed.
+ *
+ * A curve is a list of {interval, rate} pairs, fastest first, ending with an
+ * entry of KNOB_SLOWEST. The first entry whose interval is at least the
+ * filtered time between edges (in 64 usec ticks) gives the rate, in quarter
+ * units per edge. A rate of 1 moves one unit per detent of a typical encoder
+ * (4 edges), a rate of 4 one unit per edge and so on.
+ *
+ * After a pause the filter is seeded with the first interval instead of
+ * creeping down to it, so a quick spin is quick from its second edge. Turned
+ * back it starts at the slow end and speeds up gradually, to back off a
+ * station by a click at a time.
+ */
+
+#include "global.h"
+
+#define KNOB_IDLE 250  // msecs without an edge after which the knob is at rest
+#define KNOB_FILTER 2  // the filter takes 1/4 of each new interval
+
+static uint32_t knobLastMs = 0;      // millis() of the previous edge
+static uint16_t knobLastTime = 0;    // timestamp of the previous edge, 64 usec ticks
+static uint16_t knobInterval = KNOB_SLOWEST; // filtered time between edges
+static int8_t knobLastDir = 0;
+static bool knobSeed = false;        // the next interval replaces the filtered one
+static uint16_t knobRate = 4;        // rate used for the last edge
+static int8_t knobResidue = 0;       // quarter units not handed out yet
+static const knobCurve_t *knobCurve = NULL;
+
+static uint16_t knobCurveRate(const knobCurve_t *curve)
+{
+  while (pgm_read_word(&curve->interval) < knobInterval)
+    curve++;
+  return pgm_read_word(&curve->rate);
+}
+
+/**
+ * Drains the encoder and returns how many units the knob has moved since the
+ * last call, positive clockwise. It never waits.
+ */
+int32_t knob_read(const knobCurve_t *curve)
+{
+  int32_t quarters = 0;
+  int8_t step;
+  uint16_t time;
+
+  if (curve != knobCurve)
+  { // a new user of the knob, don't hand it the leftovers of the last one
+    knobCurve = curve;
+    knobResidue = 0;
+  }
+
+  if (simulateIO)
+  { // the simulated knob moves a whole unit per count
+    return enc_read();
+  }
+
+  while (enc_pop(&step, &time))
+  {
+    uint16_t dt = time - knobLastTime;
+    int8_t dir = step > 0 ? 1 : -1;
+
+    bool idle = millis() - knobLastMs > KNOB_IDLE;
+    if (idle || dir != knobLastDir)
+    { // starting again or turned back, start slow
+      knobInterval = KNOB_SLOWEST;
+      knobSeed = idle;
+    }
+    else if (knobSeed)
+    {
+      knobInterval = dt;
+      knobSeed = false;
+    }
+    else
+      knobInterval = knobInterval - (knobInterval >> KNOB_FILTER) + (dt >> KNOB_FILTER);
+
+    knobLastMs = millis();
+    knobLastTime = time;
+    knobLastDir = dir;
+    knobRate = knobCurveRate(curve);
+    quarters += (int32_t)step * knobRate;
+  }
+
+  // truncated, so a unit takes the same number of edges either way round
+  quarters += knobResidue;
+  knobResidue = quarters % 4;
+  return quarters / 4;
+}
+
+// drops the quarter units not handed out yet, see enc_reset()
+void knob_reset()
+{
+  knobResidue = 0;
+}
+
+// the units per edge at the current speed, at least 1, used to snap to a grid
+uint16_t knob_step()
+{
+  return knobRate < 4 ? 1 : knobRate / 4;
+}
@@ -4,7 +4,6 @@
  */
 
 #include "global.h"
-#include <Wire.h>
 #include <EEPROM.h>
 
 settings_t settings;
@@ -15,7 +14,7 @@ static void checkButton();
 // temp buffer to build strings for the display
 char cBuf[30];
 char bBuf[30];
-char printBuff[2][31]; // mirrors what is showing on the two lines of the display
+char printBuff[2][17]; // mirrors what is showing on the two lines of the display, padded to 16 columns
 int count = 0;         // to generally count ticks, loops, etc
 
 uint32_t usbCarrier;
@@ -43,6 +42,7 @@ unsigned char txFilter = 0; // which of the four transmit filters are in use
 
 /**
  * Our own delay. During any delay, the raduino should still be processing a few times.
+ * The keyer and CAT (the tasks marked TASK_YIELD) keep running, see ubitx_sched.cpp
  */
 
 void active_delay(uint32_t delay_by)
@@ -52,7 +52,8 @@ void active_delay(uint32_t delay_by)
   while (millis() - timeStart <= delay_by)
   {
     // Background Work
-    checkCAT();
+    watchdogFeed();
+    sched_yield();
   }
 }
 
@@ -114,23 +115,132 @@ void setTXFilters(uint32_t frequency)
  * through mixing of the second local oscillator.
  */
 
-void setFrequency(uint32_t f)
+static void stageOscillators(uint32_t f, bool isUSB)
 {
-  setTXFilters(f);
-
-  if (settings.isUSB)
+  if (isUSB)
   {
-    si5351bx_setfreq(2, firstIF + f);
-    si5351bx_setfreq(1, firstIF + usbCarrier);
+    si5351bx_stage(2, firstIF + f);
+    si5351bx_stage(1, firstIF + usbCarrier);
   }
   else
   {
-    si5351bx_setfreq(2, firstIF + f);
-    si5351bx_setfreq(1, firstIF - usbCarrier);
+    si5351bx_stage(2, firstIF + f);
+    si5351bx_stage(1, firstIF - usbCarrier);
   }
+}
+
+static void stageFrequency(uint32_t f)
+{
+  setTXFilters(f);
+  stageOscillators(f, settings.isUSB);
   settings.frequency = f;
 }
 
+/**
+ * Ready-made oscillator registers for the receiver and for the two ways it can
+ * go into transmit. The rx bank is saved whenever the receiver is retuned, the
+ * tx banks are rebuilt from the loop whenever what startTx() would switch to has
+ * changed (frequency, sideband, split, rit, sidetone or carrier). A T/R switch
+ * then just stages a bank and sends the registers that differ, with none of the
+ * divider math in the way of the first cw element.
+ */
+typedef struct
+{
+  si5351bx_bank_t osc;
+  uint32_t freq;    // dial frequency, or the carrier frequency for the cw bank
+  uint32_t carrier; // the usbCarrier it was computed with
+  bool isUSB;
+} oscBank_t;
+
+static oscBank_t rxBank, txSsbBank, txCwBank;
+
+static bool bankMatches(const oscBank_t *bank, uint32_t freq, bool isUSB)
+{
+  return bank->freq == freq && bank->isUSB == isUSB &&
+         bank->carrier == usbCarrier && bank->osc.vcoa == si5351bx_vcoa;
+}
+
+static void bankSave(oscBank_t *bank, uint32_t freq, bool isUSB)
+{
+  si5351bx_save(&bank->osc);
+  bank->freq = freq;
+  bank->carrier = usbCarrier;
+  bank->isUSB = isUSB;
+}
+
+// the exact cw frequency is the tuned frequency + sidetone
+static uint32_t cwCarrier(uint32_t f, bool isUSB)
+{
+  return isUSB ? (f + settings.sideTone) : (f - settings.sideTone);
+}
+
+// the frequency and sideband startTx() is going to switch to
+static void txTarget(uint32_t *f, bool *isUSB)
+{
+  *f = settings.frequency;
+  *isUSB = settings.isUSB;
+
+  if (settings.ritOn)
+    *f = ritTxFrequency;
+  else if (settings.splitOn)
+  {
+    if (settings.vfoActive == VFO_B)
+    {
+      *f = settings.vfoA;
+      *isUSB = isUsbVfoA;
+    }
+    else if (settings.vfoActive == VFO_A)
+    {
+      *f = settings.vfoB;
+      *isUSB = isUsbVfoB;
+    }
+  }
+}
+
+// rebuilds the tx banks that no longer match the receiver, called from the loop
+static void prepareTx()
+{
+  uint32_t f, cwFreq;
+  bool isUSB;
+
+  // the staged registers are put back from the rx bank when we are done
+  if (settings.inTx || !bankMatches(&rxBank, settings.frequency, settings.isUSB))
+    return;
+
+  txTarget(&f, &isUSB);
+  cwFreq = cwCarrier(f, isUSB);
+
+  if (!bankMatches(&txSsbBank, f, isUSB))
+  {
+    stageOscillators(f, isUSB);
+    bankSave(&txSsbBank, f, isUSB);
+    si5351bx_load(&rxBank.osc);
+  }
+
+  if (!bankMatches(&txCwBank, cwFreq, false))
+  {
+    // the second local oscillator and the bfo are off
+    si5351bx_stage(0, 0);
+    si5351bx_stage(1, 0);
+    si5351bx_stage(2, cwFreq);
+    bankSave(&txCwBank, cwFreq, false);
+    si5351bx_load(&rxBank.osc);
+  }
+}
+
+void setFrequency(uint32_t f)
+{
+  TRACE(TR_FREQ, f / 1000);
+  catStateChanged();
+  // both local oscillators go out in one burst, so they are never
+  // left in an inconsistent state in between
+  stageFrequency(f);
+  si5351bx_commit();
+
+  if (!settings.inTx)
+    bankSave(&rxBank, f, settings.isUSB);
+}
+
 /**
  * startTx is called by the PTT, cw keyer and CAT protocol to
  * put the uBitx in tx mode. It takes care of rit settings, sideband settings
@@ -140,6 +250,7 @@ void setFrequency(uint32_t f)
 
 void startTx(uint8_t txMode)
 {
+  TRACE(TR_START_TX, txMode);
   digitalWrite(PIN_TX_RX, 1);
   settings.inTx = true;
 
@@ -147,7 +258,7 @@ void startTx(uint8_t txMode)
   {
     // save the current as the rx frequency
     ritRxFrequency = settings.frequency;
-    setFrequency(ritTxFrequency);
+    settings.frequency = ritTxFrequency;
   }
   else
   {
@@ -166,34 +277,51 @@ void startTx(uint8_t txMode)
         settings.isUSB = isUsbVfoB;
       }
     }
-    setFrequency(settings.frequency);
   }
 
+  // the bank prepared by the loop is normally still current
+  bool ready;
   if (txMode == TX_CW)
+    ready = bankMatches(&txCwBank, cwCarrier(settings.frequency, settings.isUSB), false) &&
+            si5351bx_load(&txCwBank.osc);
+  else
+    ready = bankMatches(&txSsbBank, settings.frequency, settings.isUSB) &&
+            si5351bx_load(&txSsbBank.osc);
+
+  if (ready)
+    setTXFilters(settings.frequency);
+  else
   {
-    // turn off the second local oscillator and the bfo
-    si5351bx_setfreq(0, 0);
-    si5351bx_setfreq(1, 0);
+    stageFrequency(settings.frequency);
 
-    // shift the first oscillator to the tx frequency directly
-    // the key up and key down (CW_KEY) will toggle the carrier unbalancing
-    // the exact cw frequency is the tuned frequency + sidetone
+    if (txMode == TX_CW)
+    {
+      // turn off the second local oscillator and the bfo
+      si5351bx_stage(0, 0);
+      si5351bx_stage(1, 0);
 
-    uint32_t cwFreq = (settings.isUSB) ? (settings.frequency + settings.sideTone) : (settings.frequency - settings.sideTone);
-    si5351bx_setfreq(2, cwFreq);
+      // shift the first oscillator to the tx frequency directly
+      // the key up and key down (CW_KEY) will toggle the carrier unbalancing
+      si5351bx_stage(2, cwCarrier(settings.frequency, settings.isUSB));
+    }
   }
+  si5351bx_commit();
+  // the carrier may be keyed right after we return, the oscillators
+  // have to be on the tx frequency by then
+  i2cFlush();
+  catStateChanged();
   updateDisplay();
 }
 
 void stopTx()
 {
+  TRACE(TR_STOP_TX, 0);
   settings.inTx = false;
-  digitalWrite(PIN_TX_RX, LOW);    // turn off the tx circuit
-  si5351bx_setfreq(0, usbCarrier); // set back the cardrier oscillator anyway, cw tx switches it off
+  digitalWrite(PIN_TX_RX, LOW); // turn off the tx circuit
 
   if (settings.ritOn)
   {
-    setFrequency(ritRxFrequency);
+    settings.frequency = ritRxFrequency;
   }
   else
   {
@@ -214,10 +342,20 @@ void stopTx()
         settings.isUSB = isUsbVfoB;
       }
     }
+  }
 
-    // restore the normal frequency
+  // restore the normal frequency
+  if (bankMatches(&rxBank, settings.frequency, settings.isUSB) && si5351bx_load(&rxBank.osc))
+  {
+    setTXFilters(settings.frequency);
+    si5351bx_commit();
+  }
+  else
+  {
+    si5351bx_stage(0, usbCarrier); // set back the cardrier oscillator anyway, cw tx switches it off
     setFrequency(settings.frequency);
   }
+  catStateChanged();
   updateDisplay();
 }
 
@@ -270,6 +408,46 @@ void checkPTT()
     stopTx();
 }
 
+/**
+ * The VFOs are written to the EEPROM a little after they change, from the
+ * main loop and never while transmitting. Flipping back and forth between
+ * the VFOs doesn't wear the EEPROM and the menu doesn't wait on the writes.
+ */
+#define SAVE_DELAY 2000 // msecs
+#define SAVE_VFO_A 0x01
+#define SAVE_VFO_B 0x02
+
+static uint8_t saveDirty = 0;
+static uint32_t saveTime = 0;
+
+void saveVfoLater(uint8_t vfo)
+{
+  saveDirty |= vfo == VFO_A ? SAVE_VFO_A : SAVE_VFO_B;
+  saveTime = millis();
+}
+
+// writes one vfo per run to keep the time spent in the task short
+static void saveSettings()
+{
+  if (!saveDirty || settings.inTx || millis() - saveTime < SAVE_DELAY)
+    return;
+
+  PROFILE(PROF_EEPROM);
+
+  if (saveDirty & SAVE_VFO_A)
+  {
+    EEPROM.put(VFO_A, settings.vfoA);
+    EEPROM.update(VFO_A_MODE, isUsbVfoA ? VFO_MODE_USB : VFO_MODE_LSB);
+    saveDirty &= ~SAVE_VFO_A;
+  }
+  else
+  {
+    EEPROM.put(VFO_B, settings.vfoB);
+    EEPROM.update(VFO_B_MODE, isUsbVfoB ? VFO_MODE_USB : VFO_MODE_LSB);
+    saveDirty &= ~SAVE_VFO_B;
+  }
+}
+
 static void checkButton()
 {
   // only if the button is pressed
@@ -287,32 +465,35 @@ static void checkButton()
 }
 
 /**
- * The tuning jumps by 50 Hz on each step when you tune slowly
+ * The tuning jumps by 10 Hz on each click when you tune slowly
  * As you spin the encoder faster, the jump size also increases
  * This way, you can quickly move to another band by just spinning the
- * tuning knob
+ * tuning knob. The frequency is snapped to the step in use, so a fast
+ * spin lands on round numbers and slowing down gets back to 10 Hz.
+ * The steps are in units of 10 Hz, see ubitx_knob.cpp for the curve format.
  */
+const knobCurve_t tuneCurve[] PROGMEM = {
+    {62, 4000},          // under 4 msec between edges, 10 KHz per edge
+    {125, 200},          // under 8 msec, 500 Hz
+    {234, 20},           // under 15 msec, 50 Hz
+    {625, 4},            // under 40 msec, 10 Hz
+    {KNOB_SLOWEST, 1}};  // 10 Hz per click
 
 void doTuning()
 {
-  int s = enc_read();
+  int32_t s = knob_read(tuneCurve);
 
   if (s != 0)
   {
     uint32_t prev_freq = settings.frequency;
+    int32_t f = (int32_t)settings.frequency + s * 10;
+    uint32_t grid = knob_step() * 10l;
 
-    if (s > 4)
-      settings.frequency += 10000l;
-    else if (s > 2)
-      settings.frequency += 500;
-    else if (s > 0)
-      settings.frequency += 50l;
-    else if (s > -2)
-      settings.frequency -= 50l;
-    else if (s > -4)
-      settings.frequency -= 500l;
-    else
-      settings.frequency -= 10000l;
+    if (f < LOWEST_FREQ)
+      f = LOWEST_FREQ;
+    if (f > HIGHEST_FREQ)
+      f = HIGHEST_FREQ;
+    settings.frequency = f - f % grid;
 
     // check if we have crossed the 10 MHz border
     if (prev_freq < 10000000l && settings.frequency > 10000000l)
@@ -328,17 +509,19 @@ void doTuning()
 }
 
 /**
- * RIT only steps back and forth by 100 hz at a time
+ * RIT steps back and forth by 10 hz at a time, up to 500 hz when spun fast
  */
+const knobCurve_t ritCurve[] PROGMEM = {
+    {125, 200},         // under 8 msec between edges, 500 Hz per edge
+    {234, 40},          // under 15 msec, 100 Hz
+    {KNOB_SLOWEST, 4}}; // 10 Hz per edge
+
 void doRIT()
 {
-  int knob = enc_read();
+  int32_t knob = knob_read(ritCurve);
   uint32_t old_freq = settings.frequency;
 
-  if (knob < 0)
-    settings.frequency -= 100l;
-  else if (knob > 0)
-    settings.frequency += 100;
+  settings.frequency += knob * 10;
 
   if (old_freq != settings.frequency)
   {
@@ -444,6 +627,7 @@ void initPorts()
   pinMode(PIN_ENC_A, INPUT_PULLUP);
   pinMode(PIN_ENC_B, INPUT_PULLUP);
   pinMode(PIN_FBUTTON, INPUT_PULLUP);
+  enc_init();
 
   // configure the function button to use the external pull-up
   //  pinMode(FBUTTON, INPUT);
@@ -469,6 +653,68 @@ void initPorts()
   digitalWrite(PIN_CW_KEY, 0);
 }
 
+/**
+ * The jobs of the main loop, each is a task in the table below
+ */
+
+static void keyerTask()
+{
+  // the simulator uses the serial port, keyer and CAT are off in sim mode
+  if (!simulateIO)
+    cwKeyer();
+}
+
+static void pttTask()
+{
+  if (!settings.txCAT)
+    checkPTT();
+}
+
+static void tuneTask()
+{
+  // tune only when not tranmsitting
+  if (settings.inTx)
+    return;
+
+  if (settings.ritOn)
+    doRIT();
+  else
+    doTuning();
+  prepareTx();
+}
+
+static void catTask()
+{
+  if (!simulateIO)
+    checkCAT();
+}
+
+// the serial port belongs to CAT unless the simulator is on
+static void simTask()
+{
+  if (simulateIO)
+    HandleSimIo();
+}
+
+// a slice of the display update, it runs in waits too so menus show
+static void displayTask()
+{
+  displayFlush();
+}
+
+// the keyer comes first, CAT after the encoder as it might put the radio into TX
+const task_t tasks[] PROGMEM = {
+    // run, period, deadline, priority, flags
+    {keyerTask, 0, 2, 0, TASK_YIELD | TASK_RADIO},
+    {pttTask, 5, 20, 1, 0},
+    {checkButton, 10, 100, 2, 0},
+    {tuneTask, 0, 50, 3, 0},
+    {catTask, 0, 10, 4, TASK_YIELD | TASK_RADIO},
+    {displayTask, 0, 50, 5, TASK_YIELD},
+    {simTask, 0, 100, 6, 0},
+    {meterTask, 50, 200, 7, 0},
+    {saveSettings, 100, 1000, 8, 0}};
+
 void setup()
 {
   settings.vfoA = 7150000L;
@@ -492,61 +738,48 @@ void setup()
 
   Serial.begin(38400);
   Serial.flush();
+  watchdogInit();
 
   initDisplay();
 
   // we print this line so this shows up even if the raduino
   // crashes later in the code
   printLine2("uBITX v5.11");
+  displaySync();
   // active_delay(500);
 
-  //  initMeter(); //not used in this build
+  initMeter();
   initSettings();
   initPorts();
+  i2cInit();
   initOscillators(settings.pllCalibration);
 
   settings.frequency = settings.vfoA;
   setFrequency(settings.vfoA);
   updateDisplay();
 
+  // the display is sent from a task, factory alignment needs it running
+  sched_init(tasks, sizeof(tasks) / sizeof(tasks[0]));
+
   if (btnDown())
   {
     factory_alignment();
   }
+
+  watchdogArm();
+
+  // the message line goes to the S-meter now
+  printLine2("");
 }
 
 /**
  * The loop checks for keydown, ptt, function button and tuning.
+ * Each of these is a task, the scheduler runs them when they are due.
  */
 
-uint8_t flasher = 0;
 void loop()
 {
-
-  // AF DISABLE FOR NOW IN SIM MODE
-  // cwKeyer();
-
-  if (!settings.txCAT)
-  {
-    checkPTT();
-  }
-
-  checkButton();
-
-  // tune only when not tranmsitting
-  if (!settings.inTx)
-  {
-    if (settings.ritOn)
-    {
-      doRIT();
-    }
-    else
-    {
-      doTuning();
-    }
-  }
-
-  // we check CAT after the encoder as it might put the radio into TX
-  // checkCAT();
-  HandleSimIo();
+  loopStatsMark();
+  watchdogLoop();
+  sched_run();
 }
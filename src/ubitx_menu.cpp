@@ -43,10 +43,16 @@ void waitForBtnUp()
   active_delay(50);
 }
 
+// one step per click, several per edge when spun fast
+const knobCurve_t valueCurve[] PROGMEM = {
+    {125, 16},          // under 8 msec between edges, 4 steps per edge
+    {312, 4},           // under 20 msec, 1 step per edge
+    {KNOB_SLOWEST, 1}}; // 1 step per click
+
 static int getValueByKnob(int minimum, int maximum, int step_size, int initial, const char *prefix, const char *postfix)
 {
-  int knob = 0;
-  int knob_value;
+  int32_t knob = 0;
+  int32_t knob_value;
 
   while (btnDown())
   {
@@ -63,16 +69,19 @@ static int getValueByKnob(int minimum, int maximum, int step_size, int initial,
   printLine2(bBuf);
   active_delay(300);
 
+  enc_reset();
   while (!btnDown() && !pttOn())
   {
+    watchdogFeed();
 
-    knob = enc_read();
+    knob = knob_read(valueCurve);
     if (knob != 0)
     {
-      if (knob_value > minimum && knob < 0)
-        knob_value -= step_size;
-      if (knob_value < maximum && knob > 0)
-        knob_value += step_size;
+      knob_value += knob * step_size;
+      if (knob_value < minimum)
+        knob_value = minimum;
+      if (knob_value > maximum)
+        knob_value = maximum;
 
       printLine2(prefix);
       itoa(knob_value, cBuf, 10);
@@ -80,7 +89,7 @@ static int getValueByKnob(int minimum, int maximum, int step_size, int initial,
       strcat(bBuf, postfix);
       printLine1(bBuf);
     }
-    checkCAT();
+    sched_yield();
   }
 
   return knob_value;
@@ -107,8 +116,10 @@ static void menuBand(bool btn)
 
   ritDisable();
 
+  enc_reset();
   while (!btnDown())
   {
+    watchdogFeed();
 
     knob = enc_read();
     if (knob != 0)
@@ -131,9 +142,9 @@ static void menuBand(bool btn)
         settings.isUSB = true;
       else
         settings.isUSB = false;
+      catStateChanged();
       updateDisplay();
     }
-    checkCAT();
     active_delay(20);
   }
 
@@ -191,11 +202,7 @@ void menuVfoToggle(bool btn)
     {
       settings.vfoB = settings.frequency;
       isUsbVfoB = settings.isUSB;
-      EEPROM.put(VFO_B, settings.frequency);
-      if (isUsbVfoB)
-        EEPROM.put(VFO_B_MODE, VFO_MODE_USB);
-      else
-        EEPROM.put(VFO_B_MODE, VFO_MODE_LSB);
+      saveVfoLater(VFO_B);
 
       settings.vfoActive = VFO_A;
       //      printLine2("Selected VFO A  ");
@@ -206,11 +213,7 @@ void menuVfoToggle(bool btn)
     {
       settings.vfoA = settings.frequency;
       isUsbVfoA = settings.isUSB;
-      EEPROM.put(VFO_A, settings.frequency);
-      if (isUsbVfoA)
-        EEPROM.put(VFO_A_MODE, VFO_MODE_USB);
-      else
-        EEPROM.put(VFO_A_MODE, VFO_MODE_LSB);
+      saveVfoLater(VFO_A);
 
       settings.vfoActive = VFO_B;
       //      printLine2("Selected VFO B  ");
@@ -262,6 +265,7 @@ static void menuSidebandToggle(bool btn)
     {
       isUsbVfoB = settings.isUSB;
     }
+    catStateChanged();
     updateDisplay();
     menuOn = 0;
   }
@@ -291,6 +295,7 @@ static void menuSplitToggle(bool btn)
       settings.ritOn = false;
       printLine2("Split Off");
     }
+    catStateChanged();
     active_delay(500);
     printLine2("");
     updateDisplay();
@@ -318,6 +323,7 @@ static void menuCWSpeed(bool btn)
 
   printLine2("CW Speed set!");
   settings.cwSpeed = 1200 / wpm;
+  catStateChanged();
   EEPROM.put(CW_SPEED, settings.cwSpeed);
   active_delay(500);
 
@@ -375,12 +381,10 @@ int menuSetup(bool btn)
   return 0;
 }
 
-// this is used by the si5351 routines in the ubitx_5351 file
-extern uint32_t si5351bx_vcoa;
-
 void calibrateClock()
 {
   int knob = 0;
+  uint8_t held = sched_hold(TASK_RADIO); // no CAT or keyer near the clock
 
   // keep clear of any previous button press
   waitForBtnUp();
@@ -395,7 +399,7 @@ void calibrateClock()
 
   // turn off the second local oscillator and the bfo
   si5351_set_calibration(settings.pllCalibration);
-  startTx(TX_CW);
+  startTx(TX_CW); // commits the new calibration along with the cw setup
   si5351bx_setfreq(2, 10000000l);
 
   strcpy(bBuf, "#1 10 MHz cal:");
@@ -403,8 +407,11 @@ void calibrateClock()
   strcat(bBuf, cBuf);
   printLine2(bBuf);
 
+  enc_reset();
   while (!btnDown())
   {
+    watchdogFeed();
+    sched_yield();
 
     if (pttOn() && !settings.keyDown)
       cwKeydown();
@@ -421,7 +428,8 @@ void calibrateClock()
       continue; // don't update the frequency or the display
 
     si5351_set_calibration(settings.pllCalibration);
-    si5351bx_setfreq(2, 10000000l);
+    si5351bx_stage(2, 10000000l);
+    si5351bx_commit();
     strcpy(bBuf, "#1 10 MHz cal:");
     ltoa(settings.pllCalibration / 8750, cBuf, 10);
     strcat(bBuf, cBuf);
@@ -439,6 +447,7 @@ void calibrateClock()
   updateDisplay();
 
   waitForBtnUp();
+  sched_hold(held);
 }
 
 static void menuSetupCalibration(bool btn)
@@ -481,6 +490,7 @@ void menuSetupCarrier(bool btn)
     return;
   }
 
+  uint8_t held = sched_hold(TASK_RADIO); // no CAT or keyer near the carrier
   printLine1("Tune to best Signal");
   printLine2("Press to confirm. ");
   active_delay(1000);
@@ -490,8 +500,11 @@ void menuSetupCarrier(bool btn)
   printCarrierFreq(usbCarrier);
 
   // disable all clock 1 and clock 2
+  enc_reset();
   while (!btnDown())
   {
+    watchdogFeed();
+    sched_yield();
     knob = enc_read();
 
     if (knob > 0)
@@ -511,10 +524,11 @@ void menuSetupCarrier(bool btn)
   EEPROM.put(USB_CAL, usbCarrier);
   active_delay(1000);
 
-  si5351bx_setfreq(0, usbCarrier);
-  setFrequency(settings.frequency);
+  si5351bx_stage(0, usbCarrier);
+  setFrequency(settings.frequency); // commits the carrier with the local oscillators
   updateDisplay();
   printLine2("");
+  sched_hold(held);
   menuOn = 0;
 }
 
@@ -536,8 +550,11 @@ static void menuSetupCwTone(bool btn)
   tone(PIN_CW_TONE, settings.sideTone);
 
   // disable all clock 1 and clock 2
+  enc_reset();
   while (!pttOn() && !btnDown())
   {
+    watchdogFeed();
+    sched_yield();
     knob = enc_read();
 
     if (knob > 0 && settings.sideTone < 2000)
@@ -551,7 +568,6 @@ static void menuSetupCwTone(bool btn)
     itoa(settings.sideTone, bBuf, 10);
     printLine2(bBuf);
 
-    checkCAT();
     active_delay(20);
   }
   noTone(PIN_CW_TONE);
@@ -564,6 +580,7 @@ static void menuSetupCwTone(bool btn)
   }
   else
     settings.sideTone = prev_sideTone;
+  catStateChanged();
 
   printLine2("");
   updateDisplay();
@@ -580,6 +597,7 @@ static void menuSetupCwDelay(bool btn)
 
   active_delay(500);
   settings.cwDelayTime = getValueByKnob(10, 1000, 50, settings.cwDelayTime, "CW Delay>", " msec");
+  catStateChanged();
 
   printLine1("CW Delay Set!");
   printLine2("");
@@ -612,8 +630,11 @@ static void menuSetupKeyer(bool btn)
   else
     tmp_key = 1;
 
+  enc_reset();
   while (!btnDown())
   {
+    watchdogFeed();
+    sched_yield();
     knob = enc_read();
     if (knob < 0 && tmp_key > 0)
       tmp_key--;
@@ -670,6 +691,8 @@ static void menuReadADC(bool btn)
 
   while (!btnDown())
   {
+    watchdogFeed();
+    sched_yield();
     adc = analogRead(PIN_ANALOG_KEYER);
     itoa(adc, bBuf, 10);
     printLine1(bBuf);
@@ -683,12 +706,16 @@ void doMenu()
 {
   int select = 0;
 
+  TRACE(TR_MENU_ENTER, modeCalibrate);
   waitForBtnUp();
+  enc_reset();
 
   menuOn = 2;
 
   while (menuOn)
   {
+    watchdogFeed();
+    sched_yield();
     int i = enc_read();
     bool btnState = btnDown();
 
@@ -738,8 +765,13 @@ void doMenu()
       menuSetupKeyer(btnState);
     else
       menuExit(btnState);
+
+    if (btnState)
+      enc_reset(); // the item has had the knob, the selection starts afresh
   }
 
   waitForBtnUp();
-  checkCAT();
+  enc_reset(); // back to tuning
+  TRACE(TR_MENU_EXIT, 0);
+  sched_yield();
 }
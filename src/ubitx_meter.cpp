@@ -0,0 +1,63 @@
+/**
+ * S-meter on the spare analog input
+ *
+ * A7 (PIN_ANALOG_SPARE) is read every 50 msecs while receiving. The
+ * readings go through a running average in fixed point, 1/4 of each new
+ * reading, and a peak that follows the average up at once and falls back
+ * slowly, so short peaks stay readable. Every METER_DRAW_EVERY samples the
+ * peak is drawn with the meter glyphs in the first 8 columns of the message
+ * line, but only while that line is blank, a message or a menu takes
+ * precedence. Only the cells that changed go out to the display.
+ *
+ * The keyer reads A6 through the same ADC. The meter runs as a task and never
+ * from inside a wait, so one conversion is never started while the other is
+ * in progress, and the multiplexer is put back to A6 after each reading, the
+ * sample and hold capacitor has settled on the keyer again by the time the
+ * keyer next reads it. A reading takes about 110 usecs, at one sample
+ * every 50 msecs that is about 0.2% of the time spent receiving.
+ */
+
+#include "global.h"
+
+#define METER_DRAW_EVERY 4 // samples are 50 msecs apart (see the task table), draw at 5 Hz
+#define METER_DECAY 4      // the peak falls back by 1/16 of the distance each sample
+
+static uint16_t meterAverage = 0; // the average reading, times 16
+static uint16_t meterPeak = 0;    // the peak hold, times 16
+static uint8_t meterCount = 0;    // samples until the next draw
+static bool meterShown = false;
+
+void meterTask()
+{
+  PROFILE(PROF_METER);
+
+  if (settings.inTx)
+  {
+    if (meterShown)
+      drawMeter(-1);
+    meterShown = false;
+    meterAverage = meterPeak = 0;
+    return;
+  }
+
+  uint16_t reading = analogRead(PIN_ANALOG_SPARE);
+  // leave the multiplexer on the keyer input
+  ADMUX = (ADMUX & 0xF0) | ((PIN_ANALOG_KEYER - A0) & 0x07);
+
+  meterAverage += ((int16_t)(reading << 4) - (int16_t)meterAverage) >> 2;
+  if (meterAverage > meterPeak)
+    meterPeak = meterAverage;
+  else
+    meterPeak -= (meterPeak - meterAverage) >> METER_DECAY;
+
+  if (meterCount)
+  {
+    meterCount--;
+    return;
+  }
+  meterCount = METER_DRAW_EVERY - 1;
+
+  // 0 to 1023 times 16 onto the full scale of drawMeter(), 0 to 100
+  drawMeter(((uint32_t)meterPeak * 100) / (1023 << 4));
+  meterShown = true;
+}
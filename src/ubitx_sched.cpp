@@ -0,0 +1,150 @@
+/**
+ * A small cooperative scheduler
+ *
+ * The main loop used to call each job in turn, and every wait (debouncing
+ * a button, a menu showing a message) spun in active_delay() with only CAT
+ * being looked after. Now every job is a task in a fixed table with its own
+ * period, deadline and priority, and the main loop is a single tick that
+ * runs whatever is due, most urgent first.
+ *
+ * A wait calls sched_yield() instead of spinning. That runs only the tasks
+ * marked TASK_YIELD, so the keyer and CAT carry on while a menu is open
+ * without the menu being entered again from the button task. A task is
+ * never started while it is already running further up the stack, the
+ * keyer waiting out its start delay for instance.
+ *
+ * While the oscillators are being calibrated the keyer and CAT must stay
+ * away from them, a CAT tune or a keyed dot would leave the clock being
+ * adjusted somewhere else. sched_hold() keeps tasks with the given flags
+ * from running at all until it is called again, the waits in between still
+ * run the display.
+ *
+ * For each task the worst lateness is kept, the time from when it was due
+ * to when it started. A run that starts later than the task's deadline is
+ * counted as a miss. For a task that runs on every pass, the lateness is the
+ * time between two runs.
+ */
+
+#include "global.h"
+
+#define SCHED_MAX_TASKS 10
+
+static const task_t *schedTasks = NULL; // in PROGMEM
+static uint8_t schedCount = 0;
+static uint16_t schedRunning = 0; // a bit for each task that is on the stack
+static uint8_t schedHeld = 0;      // tasks with any of these flags don't run
+static volatile uint8_t schedCurrent = 0xFF; // the innermost running task
+static uint32_t taskDue[SCHED_MAX_TASKS];
+static uint16_t taskLate[SCHED_MAX_TASKS];
+static uint16_t taskMisses[SCHED_MAX_TASKS];
+
+void sched_init(const task_t *tasks, uint8_t count)
+{
+  uint32_t now = millis();
+
+  schedTasks = tasks;
+  schedCount = count > SCHED_MAX_TASKS ? SCHED_MAX_TASKS : count;
+  for (uint8_t i = 0; i < schedCount; i++)
+  {
+    taskDue[i] = now;
+    taskLate[i] = 0;
+    taskMisses[i] = 0;
+  }
+}
+
+/**
+ * Runs each due task that has all the flags in 'need' at most once,
+ * the lowest priority number first. The time is read again before each
+ * pick, a long task can make others due.
+ */
+static void schedPass(uint8_t need)
+{
+  uint16_t looked = 0;
+  task_t task;
+
+  while (1)
+  {
+    uint32_t now = millis();
+    int8_t pick = -1;
+    uint8_t best = 0xFF;
+
+    for (uint8_t i = 0; i < schedCount; i++)
+    {
+      if ((looked | schedRunning) & ((uint16_t)1 << i))
+        continue;
+      if ((int32_t)(now - taskDue[i]) < 0)
+        continue;
+      memcpy_P(&task, &schedTasks[i], sizeof(task));
+      if ((task.flags & need) != need || (task.flags & schedHeld))
+        continue;
+      if (task.priority < best)
+      {
+        best = task.priority;
+        pick = i;
+      }
+    }
+    if (pick < 0)
+      return;
+
+    memcpy_P(&task, &schedTasks[pick], sizeof(task));
+    looked |= (uint16_t)1 << pick;
+
+    uint32_t late = now - taskDue[pick];
+    if (late > taskLate[pick])
+      taskLate[pick] = late > 0xFFFF ? 0xFFFF : late;
+    if (late > task.deadline && taskMisses[pick] < 0xFFFF)
+      taskMisses[pick]++;
+
+    // keep to the period, but don't try to catch up on runs that were missed
+    if (late >= task.period)
+      taskDue[pick] = now + task.period;
+    else
+      taskDue[pick] += task.period;
+
+    uint8_t outer = schedCurrent;
+    schedRunning |= (uint16_t)1 << pick;
+    schedCurrent = pick;
+    task.run();
+    schedCurrent = outer;
+    schedRunning &= ~((uint16_t)1 << pick);
+  }
+}
+
+// one tick of the main loop
+void sched_run()
+{
+  schedPass(0);
+}
+
+// called from inside a wait
+void sched_yield()
+{
+  schedPass(TASK_YIELD);
+}
+
+// holds back the tasks with any of the flags, 0 lets them all run again;
+// returns what was held before, to be put back when done
+uint8_t sched_hold(uint8_t flags)
+{
+  uint8_t held = schedHeld;
+  schedHeld = flags;
+  return held;
+}
+
+// the worst lateness of a task in msecs
+uint16_t sched_late(uint8_t task)
+{
+  return task < schedCount ? taskLate[task] : 0;
+}
+
+// the task that is running, 0xFF outside of the tasks
+uint8_t sched_current()
+{
+  return schedCurrent;
+}
+
+// the runs that started after their deadline
+uint16_t sched_misses(uint8_t task)
+{
+  return task < schedCount ? taskMisses[task] : 0;
+}
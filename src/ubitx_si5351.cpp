@@ -1,7 +1,7 @@
 // *************  SI5315 routines - tks Jerry Gaffke, KE7ER   ***********************
 
 // An minimalist standalone set of Si5351 routines.
-// VCOA is fixed at 875mhz, VCOB not used.
+// VCOA is fixed at 875mhz, VCOB is only used by the optional pll vfo mode.
 // The output msynth dividers are used to generate 3 independent clocks
 // with 1hz resolution to any frequency between 4khz and 109mhz.
 
@@ -10,6 +10,12 @@
 // Call si5351bx_setfreq(clknum, freq) each time one of the
 // three output CLK pins is to be updated to a new frequency.
 // A freq of 0 serves to shut down that output clock.
+// To retune several clocks at once, call si5351bx_stage(clknum, freq) for
+// each of them and then si5351bx_commit().  The staged multisynth blocks
+// go out as a single I2C burst and the output enable is written only once.
+// si5351bx_save() copies the staged registers of all clocks into a bank and
+// si5351bx_load() stages such a bank again without any of the math, which
+// is how the rx and tx settings are swapped on a T/R switch.
 
 // The global variable si5351bx_vcoa starts out equal to the nominal VCOA
 // frequency of 25mhz*35 = 875000000 Hz.  To correct for 25mhz crystal errors,
@@ -27,11 +33,34 @@
 // A value of zero gives a divide factor of 1, a value of 7 divides by 128.
 // This lightweight method is a reasonable compromise for a seldom used feature.
 
+// Setting si5351bx_pllvfo switches CLK2, the 1st LO, to the pll vfo mode.
+// Between SI5351BX_VFO_FMIN and SI5351BX_VFO_FMAX CLK2 is then driven from
+// PLLB through an even integer msynth, and the frequency is set by the PLLB
+// feedback numerator.  The divider is picked once and held for as long as
+// the vco stays in range, so a tuning step only rewrites a few numerator
+// bytes, and the integer output divider has less jitter.  Outside that
+// range CLK2 goes back to the fractional msynth from PLLA.  The calibrated
+// si5351bx_vcoa is still honored, PLLB uses the crystal frequency it implies.
+
+// The output divider of each clock is kept as 128*vcoa = msq*fout + msr,
+// which is exactly what P1 and P2 need: P1 = msq-512 and P2/P3 = msr/fout.
+// A small retune of fout by d only needs msr -= msq*d (one hardware multiply)
+// followed by a few add/compare steps to bring msr back into 0..fout-1.
+// A carry out of the seven fractional bits of msq simply moves the integer
+// divider, so only large steps, low frequencies or a new si5351bx_vcoa go
+// back to the full computation, which itself needs just one 32-bit divide.
+
+// The Si5351 registers we drive are mirrored in RAM (si5351bx_shadow).  Each
+// new register image is compared against the mirror and only the runs of bytes
+// that actually changed are sent over I2C.  A 50hz tuning step usually touches
+// just the low bytes of P1/P2, and the CLK control and output enable registers
+// are only written when they change.
+
 #include <global.h>
-#include <Wire.h>
 
 static void i2cWrite(uint8_t reg, uint8_t val);
 static void i2cWriten(uint8_t reg, uint8_t *vals, uint8_t vcnt);
+static void si5351bx_update(uint8_t reg, uint8_t *vals, uint8_t vcnt, uint8_t gap);
 static void si5351bx_init();
 
 #define BB0(x) ((uint8_t)x) // Bust int32 into Bytes
@@ -50,79 +79,363 @@ uint32_t si5351bx_vcoa = (SI5351BX_XTAL * SI5351BX_MSA); // 25mhzXtal calibrate
 static const uint8_t si5351bx_rdiv = 0;                  // 0-7, CLK pin sees fout/(2**rdiv)
 static const uint8_t si5351bx_drive[3] = {3, 3, 3};      // 0=2ma 1=4ma 2=6ma 3=8ma for CLK 0,1,2
 uint8_t si5351bx_clken = 0xFF;                           // Private, all CLK output drivers off
+bool si5351bx_pllvfo = PLL_VFO_MODE;                     // tune CLK2 with PLLB, see above
+
+#define SI5351BX_VFO_FMIN 45000000 // CLK2 range of the pll vfo mode
+#define SI5351BX_VFO_FMAX 76000000
+#define SI5351BX_VCO_MIN 600000000 // PLLB range
+#define SI5351BX_VCO_MAX 900000000
+#define SI5351BX_PLL_C 0xFFFFF     // PLLB fraction denominator, the largest there is
+static uint8_t si5351bx_vfodiv = 0;       // even CLK2 divider held in pll vfo mode
+static uint32_t si5351bx_xtal = SI5351BX_XTAL; // crystal as implied by si5351bx_vcoa
+
+// Mirror of register 3 (slot 0) and registers 16 to 65 (slots 1 to 50), which
+// covers the CLK control, PLL and output multisynth registers.  A slot is only
+// trusted once its bit is set in si5351bx_known, i.e. after it has been written.
+#define SI5351BX_SHADOW_LAST 65
+#define SI5351BX_SHADOW_SIZE (SI5351BX_SHADOW_LAST - 15 + 1)
+#define SI5351BX_GAP_MERGE 2 // clean bytes cheaper to resend than a new transaction
+static uint8_t si5351bx_shadow[SI5351BX_SHADOW_SIZE];
+static uint8_t si5351bx_known[(SI5351BX_SHADOW_SIZE + 7) / 8];
+static uint8_t si5351bx_errors = 0; // i2cErrors when the mirror was last known good
 
+// Register image staged by si5351bx_stage() and sent by si5351bx_commit()
+#define SI5351BX_BLOCK_PLLB 0x01
+#define SI5351BX_BLOCK_MS0 0x02
+#define SI5351BX_BLOCK_MS2 0x08
+static uint8_t si5351bx_image[32];  // registers 34 to 65, PLLB and msynth 0 to 2
+static uint8_t si5351bx_ctrl[3];    // registers 16 to 18, CLK 0 to 2 control
+static uint8_t si5351bx_staged = 0; // SI5351BX_BLOCK_ bits with a new image
+
+// Divider state per clock, see above.  fout is 0 when the state is not valid.
+#define SI5351BX_INC_MAXSTEP 32767 // largest fout change handled incrementally
+#define SI5351BX_INC_MAXQ 16383    // msq*step has to fit an int32
+#define SI5351BX_INC_MAXFIX 4      // add/compare rounds before giving up
+static si5351bx_div_t si5351bx_div[3];
+static uint32_t si5351bx_divvcoa; // the si5351bx_vcoa the states were computed with
+
+// the writes are queued and sent by the i2c interrupt, see ubitx_i2c.cpp
 static void i2cWrite(uint8_t reg, uint8_t val)
 { // write reg via i2c
-  Wire.beginTransmission(SI5351BX_ADDR);
-  Wire.write(reg);
-  Wire.write(val);
-  Wire.endTransmission();
+  i2cQueueWrite(SI5351BX_ADDR, reg, &val, 1);
 }
 
 static void i2cWriten(uint8_t reg, uint8_t *vals, uint8_t vcnt)
 { // write array
-  Wire.beginTransmission(SI5351BX_ADDR);
-  Wire.write(reg);
-  while (vcnt--)
-    Wire.write(*vals++);
-  Wire.endTransmission();
+  i2cQueueWrite(SI5351BX_ADDR, reg, vals, vcnt);
+}
+
+// returns the mirror slot of a register, or 0xFF if it is not mirrored
+static uint8_t si5351bx_slot(uint8_t reg)
+{
+  if (reg == 3)
+    return 0;
+  if (reg >= 16 && reg <= SI5351BX_SHADOW_LAST)
+    return reg - 15;
+  return 0xFF;
+}
+
+// true if the register is mirrored and the chip already holds val
+static bool si5351bx_clean(uint8_t reg, uint8_t val)
+{
+  uint8_t slot = si5351bx_slot(reg);
+  if (slot == 0xFF || !(si5351bx_known[slot >> 3] & (1 << (slot & 7))))
+    return false;
+  return si5351bx_shadow[slot] == val;
+}
+
+static void si5351bx_remember(uint8_t reg, uint8_t val)
+{
+  uint8_t slot = si5351bx_slot(reg);
+  if (slot == 0xFF)
+    return;
+  si5351bx_shadow[slot] = val;
+  si5351bx_known[slot >> 3] |= 1 << (slot & 7);
+}
+
+static void si5351bx_update(uint8_t reg, uint8_t *vals, uint8_t vcnt, uint8_t gap)
+{ // write only the changed bytes of an array of registers, merging clean gaps up to gap bytes
+  uint8_t i = 0;
+  while (i < vcnt)
+  {
+    // skip the leading clean bytes
+    if (si5351bx_clean(reg + i, vals[i]))
+    {
+      i++;
+      continue;
+    }
+
+    // extend the run while the gaps of clean bytes stay short
+    uint8_t first = i, last = i;
+    for (i++; i < vcnt && i - last <= gap + 1; i++)
+    {
+      if (!si5351bx_clean(reg + i, vals[i]))
+        last = i;
+    }
+    i = last + 1;
+
+    i2cWriten(reg + first, vals + first, last - first + 1);
+    for (uint8_t j = first; j <= last; j++)
+      si5351bx_remember(reg + j, vals[j]);
+  }
 }
 
 static void si5351bx_init()
 {
   // Call once at power-up, start PLLA
   uint32_t msxp1;
-  Wire.begin();
+  memset(si5351bx_known, 0, sizeof(si5351bx_known)); // the mirror is stale until rewritten
+  for (uint8_t i = 0; i < 3; i++)
+    si5351bx_ctrl[i] = 0x0C | si5351bx_drive[i];
+  si5351bx_vfodiv = 0; // CLK2 control was reset above, pick the pll vfo divider again
   i2cWrite(149, 0);                    // SpreadSpectrum off
   i2cWrite(3, si5351bx_clken);         // Disable all CLK output drivers
+  si5351bx_remember(3, si5351bx_clken);
   i2cWrite(183, SI5351BX_XTALPF << 6); // Set 25mhz crystal load capacitance
   msxp1 = 128 * SI5351BX_MSA - 512;    // and msxp2=0, msxp3=1, not fractional
   uint8_t vals[8] = {0, 1, BB2(msxp1), BB1(msxp1), BB0(msxp1), 0, 0, 0};
-  i2cWriten(26, vals, 8); // Write to 8 PLLA msynth regs
-  i2cWrite(177, 0x20);    // Reset PLLA  (0x80 resets PLLB)
+  si5351bx_update(26, vals, 8, SI5351BX_GAP_MERGE); // Write to 8 PLLA msynth regs
+  i2cWrite(177, 0x20);          // Reset PLLA  (0x80 resets PLLB)
   // for (reg=16; reg<=23; reg++) i2cWrite(reg, 0x80);    // Powerdown CLK's
   // i2cWrite(187, 0);                  // No fannout of clkin, xtal, ms0, ms4
 
   // initializing the ppl2 as well
-  i2cWriten(34, vals, 8); // Write to 8 PLLA msynth regs
+  si5351bx_update(34, vals, 8, SI5351BX_GAP_MERGE); // Write to 8 PLLB msynth regs
   i2cWrite(177, 0xa0);    // Reset PLLA  & PPLB (0x80 resets PLLB)
 }
 
-void si5351bx_setfreq(uint8_t clknum, uint32_t fout)
-{ // Set a CLK to fout Hz
-  uint32_t msa, msb, msc, msxp1, msxp2, msxp3p2top;
+// bits of long division: q,r = (q << bits) + (r << bits)/d, (r << bits)%d for r < d < 2^31
+static void si5351bx_frac(uint32_t *q, uint32_t *r, uint32_t d, uint8_t bits)
+{
+  for (uint8_t i = 0; i < bits; i++)
+  {
+    *q <<= 1;
+    *r <<= 1;
+    if (*r >= d)
+    {
+      *r -= d;
+      *q |= 1;
+    }
+  }
+}
+
+// fills the 8 registers of a pll or output msynth from P1, P2 and P3
+static void si5351bx_pack(uint8_t *vals, uint32_t p1, uint32_t p2, uint32_t p3)
+{
+  uint32_t p3p2top = (((p3 & 0x0F0000) << 4) | p2); // 2 top nibbles
+  vals[0] = BB1(p3);
+  vals[1] = BB0(p3);
+  vals[2] = BB2(p1);
+  vals[3] = BB1(p1);
+  vals[4] = BB0(p1);
+  vals[5] = BB2(p3p2top);
+  vals[6] = BB1(p2);
+  vals[7] = BB0(p2);
+}
+
+// try to move a divider state to fout with additions only
+static bool si5351bx_divstep(si5351bx_div_t *div, uint32_t fout)
+{
+  int32_t step = (int32_t)(fout - div->fout);
+  if (!div->fout || div->msq > SI5351BX_INC_MAXQ ||
+      step > SI5351BX_INC_MAXSTEP || step < -SI5351BX_INC_MAXSTEP)
+    return false;
+
+  int32_t msr = (int32_t)div->msr - (int32_t)(int16_t)div->msq * (int16_t)step;
+  uint32_t msq = div->msq;
+  uint8_t fix = 0;
+  while (msr < 0)
+  {
+    if (++fix > SI5351BX_INC_MAXFIX)
+      return false;
+    msr += fout;
+    msq--;
+  }
+  while (msr >= (int32_t)fout)
+  {
+    if (++fix > SI5351BX_INC_MAXFIX)
+      return false;
+    msr -= fout;
+    msq++;
+  }
+  div->fout = fout;
+  div->msq = msq;
+  div->msr = msr;
+  return true;
+}
+
+// the full computation, a single divide and then 7 bits of long division
+static void si5351bx_divfull(si5351bx_div_t *div, uint32_t fout)
+{
+  div->fout = fout;
+  div->msq = si5351bx_vcoa / fout; // Integer part of vco/fout
+  div->msr = si5351bx_vcoa % fout; // Fractional part of vco/fout
+  si5351bx_frac(&div->msq, &div->msr, fout, 7);
+}
+
+// CLK2 from PLLB with an even integer output divider, false if fout is out of range
+static bool si5351bx_stagevfo(uint32_t fout)
+{
+  if (!si5351bx_pllvfo || fout < SI5351BX_VFO_FMIN || fout > SI5351BX_VFO_FMAX)
+    return false;
+
+  // hold the divider as long as the vco stays in range, else pick the
+  // even divider that puts the vco closest to the middle of its range
+  uint32_t vco = fout * si5351bx_vfodiv;
+  if (vco < SI5351BX_VCO_MIN || vco > SI5351BX_VCO_MAX)
+  {
+    si5351bx_vfodiv = ((SI5351BX_VCO_MIN + SI5351BX_VCO_MAX) / 2 + fout) / (2 * fout) * 2;
+    vco = fout * si5351bx_vfodiv;
+    uint32_t p1 = (128 * (uint32_t)si5351bx_vfodiv - 512) | (((uint32_t)si5351bx_rdiv) << 20);
+    si5351bx_pack(si5351bx_image + 24, p1, 0, 1); // a=div, b=0, c=1
+    si5351bx_ctrl[2] = 0x40 | 0x20 | 0x0C | si5351bx_drive[2]; // integer | PLLB | local msynth
+    si5351bx_staged |= SI5351BX_BLOCK_MS2;
+  }
+
+  // the pll multiplier is a + b/c = vco/xtal with c at the 20 bit limit,
+  // b is the remainder r of vco/xtal times c/xtal, rounded. One step of b is
+  // xtal/c = 24hz at the vco, 1.5 to 2.4hz at the output for the dividers of
+  // 16 down to 10, the error is at most half of that.
+  uint32_t pllq = vco / si5351bx_xtal;
+  uint32_t r = vco % si5351bx_xtal;
+  uint32_t pllb = 0;
+  uint32_t rem = r;
+  si5351bx_frac(&pllb, &rem, si5351bx_xtal, 20); // r * 2^20 = pllb * xtal + rem
+  // c is one less than 2^20: take r off and round
+  int32_t fix = (int32_t)rem - (int32_t)r + (int32_t)(si5351bx_xtal >> 1);
+  if (fix < 0)
+    pllb--;
+  else if (fix >= (int32_t)si5351bx_xtal)
+    pllb++;
+  if (pllb >= SI5351BX_PLL_C)
+    pllb = SI5351BX_PLL_C - 1;
+  si5351bx_frac(&pllq, &pllb, SI5351BX_PLL_C, 7);
+  si5351bx_pack(si5351bx_image, pllq - 512, pllb, SI5351BX_PLL_C);
+  si5351bx_staged |= SI5351BX_BLOCK_PLLB;
+  return true;
+}
+
+void si5351bx_stage(uint8_t clknum, uint32_t fout)
+{ // Prepare the registers of a CLK for fout Hz, nothing is sent yet
+  uint32_t msb, msc;
   if ((fout < 500000) || (fout > 109000000)) // If clock freq out of range
     si5351bx_clken |= 1 << clknum;           //  shut down the clock
   else
   {
-    msa = si5351bx_vcoa / fout; // Integer part of vco/fout
-    msb = si5351bx_vcoa % fout; // Fractional part of vco/fout
-    msc = fout;                 // Divide by 2 till fits in reg
+    if (si5351bx_divvcoa != si5351bx_vcoa)
+    { // recalibrated, none of the divider states can be trusted
+      memset(si5351bx_div, 0, sizeof(si5351bx_div));
+      si5351bx_divvcoa = si5351bx_vcoa;
+      si5351bx_xtal = si5351bx_vcoa / SI5351BX_MSA;
+    }
+
+    if (clknum == 2 && si5351bx_stagevfo(fout))
+    {
+      si5351bx_clken &= ~(1 << clknum);
+      return;
+    }
+    if (clknum == 2)
+      si5351bx_vfodiv = 0; // left the pll range, pick a divider again on return
+
+    si5351bx_div_t *div = si5351bx_div + clknum;
+    if (div->fout != fout && !si5351bx_divstep(div, fout))
+      si5351bx_divfull(div, fout);
+
+    msb = div->msr;
+    msc = fout; // Divide by 2 till fits in reg
     while (msc & 0xfff00000)
     {
       msb = msb >> 1;
       msc = msc >> 1;
     }
-    msxp1 = (128 * msa + 128 * msb / msc - 512) | (((uint32_t)si5351bx_rdiv) << 20);
-    msxp2 = 128 * msb - 128 * msb / msc * msc;      // msxp3 == msc;
-    msxp3p2top = (((msc & 0x0F0000) << 4) | msxp2); // 2 top nibbles
-    uint8_t vals[8] = {BB1(msc), BB0(msc), BB2(msxp1), BB1(msxp1),
-                       BB0(msxp1), BB2(msxp3p2top), BB1(msxp2), BB0(msxp2)};
-    i2cWriten(42 + (clknum * 8), vals, 8);                // Write to 8 msynth regs
-                                                          //    if (clknum == 1)      //PLLB | MS src | drive current
-                                                          //      i2cWrite(16 + clknum, 0x20 | 0x0C | si5351bx_drive[clknum]); // use local msynth
-                                                          //    else
-    i2cWrite(16 + clknum, 0x0C | si5351bx_drive[clknum]); // use local msynth
+    if (msb >= msc) // rounding may leave a full unit, keep b < c
+      msb = msc - 1;
+    si5351bx_pack(si5351bx_image + 8 + clknum * 8,
+                  (div->msq - 512) | (((uint32_t)si5351bx_rdiv) << 20), msb, msc);
+    //    if (clknum == 1)      //PLLB | MS src | drive current
+    //      si5351bx_ctrl[clknum] = 0x20 | 0x0C | si5351bx_drive[clknum]; // use local msynth
+    //    else
+    si5351bx_ctrl[clknum] = 0x0C | si5351bx_drive[clknum]; // use local msynth
 
+    si5351bx_staged |= SI5351BX_BLOCK_MS0 << clknum;
     si5351bx_clken &= ~(1 << clknum); // Clear bit to enable clock
   }
-  i2cWrite(3, si5351bx_clken); // Enable/disable clock
 }
 
+void si5351bx_commit()
+{ // Send everything staged since the last commit
+  bool pllreset = false;
+  if (i2cErrors != si5351bx_errors)
+  { // writes were dropped, the mirror can't be trusted until rewritten
+    si5351bx_errors = i2cErrors;
+    memset(si5351bx_known, 0, sizeof(si5351bx_known));
+  }
+  if (si5351bx_staged)
+  {
+    // a new output divider on PLLB comes with a big jump of the pll multiplier
+    if (si5351bx_ctrl[2] & 0x20)
+    {
+      for (uint8_t i = 0; i < 8; i++)
+        if (!si5351bx_clean(58 + i, si5351bx_image[24 + i]))
+          pllreset = true;
+    }
+
+    // one burst from the first to the last staged block,
+    // the mirror still trims the clean bytes at either end
+    uint8_t first = 0, last = 3;
+    while (!(si5351bx_staged & (1 << first)))
+      first++;
+    while (!(si5351bx_staged & (1 << last)))
+      last--;
+    si5351bx_update(34 + first * 8, si5351bx_image + first * 8, (last - first + 1) * 8, 0xFF);
+    si5351bx_update(16, si5351bx_ctrl, 3, SI5351BX_GAP_MERGE);
+    si5351bx_staged = 0;
+  }
+  if (pllreset)
+    i2cWrite(177, 0x80); // Reset PLLB
+  si5351bx_update(3, &si5351bx_clken, 1, 0); // Enable/disable clock
+}
+
+// keeps a copy of everything staged so far, see si5351bx_load()
+void si5351bx_save(si5351bx_bank_t *bank)
+{
+  memcpy(bank->image, si5351bx_image, sizeof(bank->image));
+  memcpy(bank->ctrl, si5351bx_ctrl, sizeof(bank->ctrl));
+  bank->clken = si5351bx_clken;
+  bank->vfodiv = si5351bx_vfodiv;
+  memcpy(bank->div, si5351bx_div, sizeof(bank->div));
+  bank->vcoa = si5351bx_vcoa;
+}
+
+// stages a copy made by si5351bx_save(), false if the calibration has changed since
+bool si5351bx_load(const si5351bx_bank_t *bank)
+{
+  if (bank->vcoa != si5351bx_vcoa)
+    return false;
+  memcpy(si5351bx_image, bank->image, sizeof(si5351bx_image));
+  memcpy(si5351bx_ctrl, bank->ctrl, sizeof(si5351bx_ctrl));
+  si5351bx_clken = bank->clken;
+  si5351bx_vfodiv = bank->vfodiv;
+  // the next small step from here goes on incrementally
+  memcpy(si5351bx_div, bank->div, sizeof(si5351bx_div));
+  si5351bx_staged = SI5351BX_BLOCK_MS0 | (SI5351BX_BLOCK_MS0 << 1) | SI5351BX_BLOCK_MS2;
+  // PLLB only carries a valid image while CLK2 runs from it
+  if (si5351bx_vfodiv)
+    si5351bx_staged |= SI5351BX_BLOCK_PLLB;
+  return true;
+}
+
+void si5351bx_setfreq(uint8_t clknum, uint32_t fout)
+{ // Set a CLK to fout Hz
+  si5351bx_stage(clknum, fout);
+  si5351bx_commit();
+}
+
+// stages the carrier with the new calibration, call si5351bx_commit() to apply it
 void si5351_set_calibration(int32_t cal)
 {
   si5351bx_vcoa = (SI5351BX_XTAL * SI5351BX_MSA) + cal; // apply the calibration correction factor
-  si5351bx_setfreq(0, usbCarrier);
+  si5351bx_stage(0, usbCarrier);
 }
 
 void initOscillators(uint32_t calibration)
@@ -130,4 +443,5 @@ void initOscillators(uint32_t calibration)
   // initialize the SI5351
   si5351bx_init();
   si5351_set_calibration(calibration);
+  si5351bx_commit();
 }
@@ -25,14 +25,28 @@
 
 static LiquidCrystal lcd(PIN_RS, PIN_ENABLE, PIN_D0, PIN_D1, PIN_D2, PIN_D3);
 
+// printLine() fills the framebuffer, displayFlush() copies it to the display
+static char lcdFrame[2][16]; // what the display should show
+static bool lcdActivity = false; // the CAT indicator is lit over column 15 of the top line
+static uint8_t lcdRow = 0xFF; // where the display's cursor is, 0xFF when not known
+static uint8_t lcdCol = 0;
+static bool lcdMeterFree = true; // the message line is blank, the meter may use it
+
 void initDisplay()
 {
   lcd.begin(16, 2); // initialize the lcd for 16 chars 2 lines
   lcd.clear();
+
+  // the display is blank now, so is what we know of it
+  memset(printBuff, ' ', sizeof(printBuff));
+  printBuff[0][16] = 0;
+  printBuff[1][16] = 0;
+  memset(lcdFrame, ' ', sizeof(lcdFrame));
+  lcdRow = 0xFF;
 }
 
 /**
- * Meter (not used in this build for anything)
+ * Meter, fed from ubitx_meter.cpp
  * the meter is drawn using special characters. Each character is composed of 5 x 8 matrix.
  * The  s_meter array holds the definition of the these characters.
  * each line of the array is is one character such that 5 bits of every uint8_t
@@ -54,16 +68,26 @@ const uint8_t PROGMEM s_meter_bitmap[] = {
 
 // initializes the custom characters
 // we start from char 1 as char 0 terminates the string!
+// the bitmaps are in PROGMEM, createChar() reads from RAM
+static void meterChar(uint8_t location, uint8_t offset)
+{
+  uint8_t charmap[8];
+
+  memcpy_P(charmap, s_meter_bitmap + offset, sizeof(charmap));
+  lcd.createChar(location, charmap);
+}
+
 void initMeter()
 {
-  lcd.createChar(1, (uint8_t *)(s_meter_bitmap));
-  lcd.createChar(2, (uint8_t *)(s_meter_bitmap + 8));
-  lcd.createChar(3, (uint8_t *)(s_meter_bitmap + 16));
-  lcd.createChar(4, (uint8_t *)(s_meter_bitmap + 24));
-  lcd.createChar(5, (uint8_t *)(s_meter_bitmap + 32));
-  lcd.createChar(6, (uint8_t *)(s_meter_bitmap + 40));
-  lcd.createChar(0, (uint8_t *)(s_meter_bitmap + 48));
-  lcd.createChar(7, (uint8_t *)(s_meter_bitmap + 56));
+  meterChar(1, 0);
+  meterChar(2, 8);
+  meterChar(3, 16);
+  meterChar(4, 24);
+  meterChar(5, 32);
+  meterChar(6, 40);
+  meterChar(0, 48);
+  meterChar(7, 56);
+  lcdRow = 0xFF; // the cursor was left in the character memory
 }
 
 /**
@@ -71,6 +95,8 @@ void initMeter()
  * character 1 is used to simple draw the blocks of the scale of the meter
  * characters 2 to 6 are used to draw the needle in positions 1 to within the block
  * This displays a meter from 0 to 100, -1 displays nothing
+ * It goes into the first 8 columns of the message line, but only while
+ * nothing else is using that line.
  */
 
 void drawMeter(int8_t needle)
@@ -78,7 +104,11 @@ void drawMeter(int8_t needle)
   int16_t i, s;
 
   if (needle < 0)
+  {
+    if (lcdMeterFree)
+      memset(lcdFrame[0], ' ', 8);
     return;
+  }
 
   s = (needle * 4) / 10;
   for (i = 0; i < 8; i++)
@@ -91,25 +121,44 @@ void drawMeter(int8_t needle)
       meter[i] = 1;
     s = s - 5;
   }
-  if (needle >= 40)
+  if (needle >= 100) // the needle ran off the end of the scale
     meter[i - 1] = 6;
   meter[i] = 0;
+
+  if (lcdMeterFree)
+    memcpy(lcdFrame[0], meter, 8);
 }
 
-// The generic routine to display one line on the LCD
+/**
+ * The generic routine to display one line on the LCD
+ * The line is padded with spaces to the 16 columns and copied into the
+ * framebuffer, nothing is sent to the display here. displayFlush() brings the
+ * display in line with the framebuffer a few cells at a time, so printing
+ * costs no more than a copy, and a line that is printed again before it was
+ * sent only ever goes out once.
+ */
 void printLine(int linenmbr, const char *c)
 {
-  if (strcmp(c, printBuff[linenmbr]))
-  {                             // only refresh the display when there was a change
-    lcd.setCursor(0, linenmbr); // place the cursor at the beginning of the selected line
-    lcd.print(c);
-    strcpy(printBuff[linenmbr], c);
+  char *frame = lcdFrame[linenmbr];
+  bool ended = false;
+  bool blank = true;
 
-    for (uint8_t i = strlen(c); i < 16; i++)
+  for (uint8_t col = 0; col < 16; col++)
+  {
+    char ch = ended ? 0 : c[col];
+    if (ch == 0)
     { // add white spaces until the end of the 16 characters line is reached
-      lcd.print(' ');
+      ended = true;
+      ch = ' ';
     }
+    frame[col] = ch;
+    if (ch != ' ')
+      blank = false;
   }
+
+  // a blank message line is handed back to the meter
+  if (linenmbr == 0)
+    lcdMeterFree = blank;
 }
 
 //  short cut to print to the first line
@@ -123,85 +172,139 @@ void printLine2(const char *c)
   printLine(0, c);
 }
 
+// the CAT activity indicator in the last column of the top line, off puts back what was there
+void printActivity(bool on)
+{
+  lcdActivity = on;
+}
+
+/**
+ * The display task
+ * Each cell of the framebuffer is compared with printBuff, what is on the
+ * glass, and the cells that differ are written in order, until the slice has
+ * used up LCD_SLICE_USEC. Every command to the LCD takes about 40 usecs, so a
+ * slice is one or two of them and the keyer and CAT never wait long for it.
+ * Moving the cursor is a command that costs as much as writing a character,
+ * so a gap of up to LCD_GAP_MERGE unchanged cells between two changes is
+ * written again instead of jumping over it. Where the cursor is carries over
+ * from one slice to the next, tuning by a step then usually takes one
+ * cursor move and one to three cells.
+ */
+#define LCD_SLICE_USEC 60
+#define LCD_GAP_MERGE 1
+
+static char lcdWanted(uint8_t row, uint8_t col)
+{
+  if (lcdActivity && row == 0 && col == 15)
+    return '*';
+  return lcdFrame[row][col];
+}
+
+// finds the first cell that is not yet showing what it should
+static bool lcdNextDirty(uint8_t *row, uint8_t *col)
+{
+  for (uint8_t r = 0; r < 2; r++)
+    for (uint8_t c = 0; c < 16; c++)
+      if (lcdWanted(r, c) != printBuff[r][c])
+      {
+        *row = r;
+        *col = c;
+        return true;
+      }
+  return false;
+}
+
+void displayFlush()
+{
+  uint32_t start = micros();
+  uint8_t row, col;
+
+  do
+  {
+    if (!lcdNextDirty(&row, &col))
+      return;
+
+    if (row != lcdRow || col < lcdCol || col - lcdCol > LCD_GAP_MERGE)
+    {
+      lcd.setCursor(col, row);
+      lcdRow = row;
+      lcdCol = col;
+    }
+    else
+    { // the dirty cell itself, or an unchanged one on the way to it
+      char ch = lcdWanted(row, lcdCol);
+      lcd.write(ch);
+      printBuff[row][lcdCol] = ch;
+      if (++lcdCol >= 16)
+        lcdRow = 0xFF; // the cursor has run off the visible line
+    }
+  } while (micros() - start < LCD_SLICE_USEC);
+}
+
+// sends the whole framebuffer now, for when there is no scheduler to do it
+void displaySync()
+{
+  uint8_t row, col;
+
+  while (lcdNextDirty(&row, &col))
+    displayFlush();
+}
+
 // this builds up the top line of the display with frequency and mode
+// straight into the framebuffer, the digits come from the BCD copy of the frequency
 void updateDisplay()
 {
   // tks Jack Purdum W8TEE
   // replaced fsprint commmands by str commands for code size reduction
-
-  memset(cBuf, 0, sizeof(cBuf));
-  memset(bBuf, 0, sizeof(bBuf));
-
-  ultoa(settings.frequency, bBuf, DEC);
+  char *line = lcdFrame[1];
 
   if (settings.inTx)
   {
-    cBuf[0] = ' ';
-    cBuf[1] = ' ';
-    cBuf[2] = ' ';
+    line[0] = ' ';
+    line[1] = ' ';
+    line[2] = ' ';
     if (settings.cwTimeout > 0)
     {
-      cBuf[3] = 'C';
-      cBuf[4] = 'W';
-      cBuf[5] = ':';
+      line[3] = 'C';
+      line[4] = 'W';
+      line[5] = ':';
     }
     else
     {
-      cBuf[3] = 'T';
-      cBuf[4] = 'X';
-      cBuf[5] = ':';
+      line[3] = 'T';
+      line[4] = 'X';
+      line[5] = ':';
     }
   }
   else
   {
     if (settings.ritOn)
     {
-      cBuf[0] = 'R';
-      cBuf[1] = 'I';
-      cBuf[2] = 'T';
+      line[0] = 'R';
+      line[1] = 'I';
+      line[2] = 'T';
     }
     else
     {
-      cBuf[0] = (settings.isUSB) ? 'U' : 'L';
-      cBuf[1] = 'S';
-      cBuf[2] = 'B';
+      line[0] = (settings.isUSB) ? 'U' : 'L';
+      line[1] = 'S';
+      line[2] = 'B';
     }
-    cBuf[3] = ' ';
-    cBuf[4] = (settings.vfoActive == VFO_A) ? 'A' : 'B';
-    cBuf[5] = ':';
+    line[3] = ' ';
+    line[4] = (settings.vfoActive == VFO_A) ? 'A' : 'B';
+    line[5] = ':';
   }
 
   // one mhz digit if less than 10 M, two digits if more
-  if (settings.frequency < 10000000l)
-  {
-    cBuf[ 6] = ' ';
-    cBuf[ 7] = bBuf[0];
-    cBuf[ 8] = '.';
-    cBuf[ 9] = bBuf[1];
-    cBuf[10] = bBuf[2];
-    cBuf[11] = bBuf[3];
-    cBuf[12] = '.';
-    cBuf[13] = bBuf[4];
-    cBuf[14] = bBuf[5];
-    cBuf[15] = bBuf[6];
-  }
-  else
-  {
-    cBuf[ 6] = bBuf[0];
-    cBuf[ 7] = bBuf[1];
-    cBuf[ 8] = '.';
-    cBuf[ 9] = bBuf[2];
-    cBuf[10] = bBuf[3];
-    cBuf[11] = bBuf[4];
-    cBuf[12] = '.';
-    cBuf[13] = bBuf[5];
-    cBuf[14] = bBuf[6];
-    cBuf[15] = bBuf[67];
-  }
-
-  // AF TODO CHECK OUTSIDE LCD PRINT LIMITS
-  // if (settings.inTx)
-  //   strcat(cBuf, " TX");
-  printLine(1, cBuf);
-
+  bcd_sync();
+  line[ 6] = bcd_digit(7) ? '0' + bcd_digit(7) : ' ';
+  line[ 7] = '0' + bcd_digit(6);
+  line[ 8] = '.';
+  line[ 9] = '0' + bcd_digit(5);
+  line[10] = '0' + bcd_digit(4);
+  line[11] = '0' + bcd_digit(3);
+  line[12] = '.';
+  line[13] = '0' + bcd_digit(2);
+  line[14] = '0' + bcd_digit(1);
+  line[15] = '0' + bcd_digit(0);
 }
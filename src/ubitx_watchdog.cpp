@@ -0,0 +1,131 @@
+/**
+ * Stall watchdog
+ *
+ * The AVR watchdog runs in interrupt and reset mode with a 1 second timeout.
+ * The main loop feeds it on every pass, and so do the waits (active_delay)
+ * and the few loops that legitimately keep the radio busy for longer, like
+ * the menus and the keyer. If nothing feeds it for a second the radio is
+ * taken to be hung: the interrupt leaves a breadcrumb in RAM that survives
+ * the reset (the running task, the last CAT command, the number of passes
+ * through the loop and the stack pointer) and then lets the watchdog reset
+ * the chip.
+ *
+ * On the next boot the breadcrumb is added to a short history in the EEPROM,
+ * which can be read with the private CAT command 0xD3. Nothing is printed,
+ * the serial port belongs to CAT.
+ *
+ * The old Nano bootloader doesn't turn the watchdog off after a watchdog
+ * reset and keeps resetting before the sketch gets to run, so the watchdog
+ * is only armed with STALL_WATCHDOG set in config.h, for boards with Optiboot
+ * (the "new bootloader"). Whatever the setting, the watchdog is turned off
+ * in .init3, before the C runtime clears the RAM, in case something else
+ * left it running.
+ */
+
+#include "global.h"
+#include <EEPROM.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+
+#define WDT_MAGIC 0xB17E
+#define WDT_HISTORY_SIZE 4
+
+typedef struct
+{
+  uint8_t task; // running task, 0xFF when outside the scheduler
+  uint8_t cat;  // last CAT command
+  uint32_t loops;
+  uint16_t sp;
+} crumb_t;
+
+// not cleared at startup, this is how the breadcrumb gets past the reset
+static crumb_t crumb __attribute__((section(".noinit")));
+static uint16_t crumbMagic __attribute__((section(".noinit")));
+
+static uint32_t wdtLoops = 0;
+
+// runs before main(), a watchdog left running would otherwise reset us during startup
+static void watchdogEarlyOff() __attribute__((naked, used, section(".init3")));
+static void watchdogEarlyOff()
+{
+  MCUSR = 0;
+  wdt_disable();
+}
+
+/**
+ * Files the breadcrumb left by the last reset in the history, called early
+ * in setup().
+ */
+void watchdogInit()
+{
+  if (crumbMagic != WDT_MAGIC)
+    return;
+  crumbMagic = 0;
+
+  // the history is a ring, the byte at WDT_HISTORY is where the next one goes
+  uint8_t next = EEPROM.read(WDT_HISTORY) % WDT_HISTORY_SIZE;
+  EEPROM.put(WDT_HISTORY + 1 + next * sizeof(crumb_t), crumb);
+  EEPROM.write(WDT_HISTORY, (next + 1) % WDT_HISTORY_SIZE);
+}
+
+// called at the end of setup(), from here on a second without a feed resets the radio
+void watchdogArm()
+{
+#if STALL_WATCHDOG
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    wdt_reset();
+    WDTCSR = _BV(WDCE) | _BV(WDE);
+    WDTCSR = _BV(WDIE) | _BV(WDE) | _BV(WDP2) | _BV(WDP1); // 1 second
+  }
+#endif
+}
+
+void watchdogFeed()
+{
+  wdt_reset();
+}
+
+// called on each pass through loop()
+void watchdogLoop()
+{
+  wdtLoops++;
+  wdt_reset();
+}
+
+/**
+ * The private CAT command 0xD3 returns the history: the slot the next
+ * breadcrumb goes to, then the four slots of 8 bytes each, little endian:
+ *   1 byte   task
+ *   1 byte   CAT command
+ *   4 bytes  passes through the loop
+ *   2 bytes  stack pointer
+ * P1 = 1 clears the history.
+ */
+void watchdogSend()
+{
+  for (uint8_t i = 0; i < 1 + WDT_HISTORY_SIZE * sizeof(crumb_t); i++)
+    Serial.write(EEPROM.read(WDT_HISTORY + i));
+}
+
+void watchdogReset()
+{
+  for (uint8_t i = 0; i < 1 + WDT_HISTORY_SIZE * sizeof(crumb_t); i++)
+    EEPROM.update(WDT_HISTORY + i, 0);
+}
+
+#if STALL_WATCHDOG
+ISR(WDT_vect)
+{
+  crumb.task = sched_current();
+  crumb.cat = catLastOpcode;
+  crumb.loops = wdtLoops;
+  crumb.sp = SP;
+  crumbMagic = WDT_MAGIC;
+
+  // the next timeout resets the chip, make it come sooner
+  wdt_enable(WDTO_15MS);
+  while (1)
+    ;
+}
+#endif
@@ -0,0 +1,116 @@
+#ifndef HD44780_H
+#define HD44780_H
+
+/**
+ * Plays the part of a 16x2 HD44780 on the Raduino pins: rs on 8, enable on 9
+ * and d4 to d7 on 10 to 13. The bus is looked at whenever the firmware waits
+ * with delayMicroseconds(), enable is high only for the wait inside the
+ * pulse, so each nibble is taken once. The pins are read from PORTB when
+ * fakePortIo is set and from fakePins otherwise. The first four nibbles are
+ * the switch to 4 bit mode, after that they go in pairs, high one first.
+ *
+ * Each byte keeps the display busy for its execution time in fake micros,
+ * a nibble that comes in before that is counted in early.
+ */
+
+#include <Arduino.h>
+
+struct Hd44780
+{
+  char ddram[0x80];
+  uint8_t cgram[64];
+  uint8_t address;
+  bool toCgram;
+  uint8_t nibbles;  // taken since reset()
+  uint8_t high;     // the first nibble of a byte
+  uint16_t commands; // bytes received, after the 4 bit mode switch
+  uint16_t data;
+  uint32_t busyUntil; // fakeMicros when the last byte has been executed
+  uint16_t early;     // nibbles sent while the display was still busy
+};
+
+#define GLASS_CLEAR_USEC 1520 // clear and home
+#define GLASS_COMMAND_USEC 37
+#define GLASS_DATA_USEC 41
+
+static Hd44780 glass;
+
+static void glassByte(uint8_t value, bool rs)
+{
+  bool slow = !rs && (value == 0x01 || (value & 0xFE) == 0x02);
+  glass.busyUntil = fakeMicros + (rs ? GLASS_DATA_USEC : slow ? GLASS_CLEAR_USEC : GLASS_COMMAND_USEC);
+  if (rs)
+  {
+    glass.data++;
+    if (glass.toCgram)
+      glass.cgram[glass.address++ & 0x3F] = value;
+    else
+      glass.ddram[glass.address++ & 0x7F] = value;
+    return;
+  }
+
+  glass.commands++;
+  if (value & 0x80)
+  {
+    glass.toCgram = false;
+    glass.address = value & 0x7F;
+  }
+  else if (value & 0x40)
+  {
+    glass.toCgram = true;
+    glass.address = value & 0x3F;
+  }
+  else if (value == 0x01)
+  {
+    memset(glass.ddram, ' ', sizeof(glass.ddram));
+    glass.toCgram = false;
+    glass.address = 0;
+  }
+  else if ((value & 0xFE) == 0x02)
+  {
+    glass.toCgram = false;
+    glass.address = 0;
+  }
+}
+
+static void glassWatch()
+{
+  uint8_t bus = 0;
+
+  if (fakePortIo)
+    bus = PORTB & 0x3F;
+  else
+    for (uint8_t pin = 8; pin <= 13; pin++)
+      bus |= (fakePins[pin] ? 1 : 0) << (pin - 8);
+  if (!(bus & 0x02))
+    return; // enable is low
+
+  uint8_t nibble = bus >> 2;
+  bool rs = bus & 0x01;
+  if (glass.nibbles >= 4 && (int32_t)(fakeMicros - glass.busyUntil) < 0)
+    glass.early++;
+  if (glass.nibbles < 4)
+    glass.nibbles++;
+  else if (glass.nibbles++ & 1)
+    glassByte(glass.high << 4 | nibble, rs);
+  else
+    glass.high = nibble;
+}
+
+static void glassReset()
+{
+  memset(&glass, 0, sizeof(glass));
+  memset(glass.ddram, ' ', sizeof(glass.ddram));
+  for (uint8_t pin = 8; pin <= 13; pin++)
+    fakePins[pin] = LOW;
+  PORTB = 0;
+  fakeOnDelay = glassWatch;
+}
+
+// what a line of the display shows, row 1 starts at 0x40
+static bool glassShows(uint8_t row, const char *text)
+{
+  return memcmp(glass.ddram + row * 0x40, text, strlen(text)) == 0;
+}
+
+#endif
@@ -0,0 +1,171 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+
+volatile uint8_t TWBR, TWCR, TWSR, TWDR;
+volatile uint8_t PORTB, PINC, PCICR, PCMSK1;
+volatile uint8_t WDTCSR, MCUSR, ADMUX, SREG;
+volatile uint16_t SP = RAMEND;
+
+uint32_t fakeMicros = 0;
+void (*fakeOnDelay)() = NULL;
+void (*fakeOnMicros)() = NULL;
+bool fakePortIo = false;
+uint8_t fakePins[NUM_PINS];
+uint8_t fakePinModes[NUM_PINS];
+uint16_t fakeAnalog[NUM_PINS];
+FakeSerial Serial;
+EEPROMClass EEPROM;
+
+void fakeAdvance(uint32_t usecs)
+{
+  fakeMicros += usecs;
+}
+
+unsigned long micros()
+{
+  if (fakeOnMicros)
+    fakeOnMicros();
+  return fakeMicros++;
+}
+
+unsigned long millis()
+{
+  if (fakeOnMicros)
+    fakeOnMicros();
+  return fakeMicros / 1000;
+}
+
+void delay(unsigned long ms)
+{
+  fakeMicros += ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  if (fakeOnDelay)
+    fakeOnDelay();
+  fakeMicros += us;
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  fakePinModes[pin] = mode;
+  if (mode == INPUT_PULLUP)
+    fakePins[pin] = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  fakePins[pin] = val;
+}
+
+int digitalRead(uint8_t pin)
+{
+  return fakePins[pin];
+}
+
+int analogRead(uint8_t pin)
+{
+  if (pin >= A0)
+    pin -= A0;
+  ADMUX = (ADMUX & 0xF0) | (pin & 0x07);
+  fakeMicros += 112;
+  return fakeAnalog[A0 + pin];
+}
+
+void analogReference(uint8_t) {}
+void tone(uint8_t, unsigned int, unsigned long) {}
+void noTone(uint8_t) {}
+
+char *ltoa(long value, char *str, int base)
+{
+  if (value < 0 && base == 10)
+  {
+    str[0] = '-';
+    ultoa(-(unsigned long)value, str + 1, base);
+    return str;
+  }
+  return ultoa(value, str, base);
+}
+
+char *itoa(int value, char *str, int base)
+{
+  return ltoa(value, str, base);
+}
+
+char *ultoa(unsigned long value, char *str, int base)
+{
+  char digits[33];
+  int n = 0;
+
+  do
+  {
+    digits[n++] = "0123456789abcdefghijklmnopqrstuvwxyz"[value % base];
+    value /= base;
+  } while (value);
+  for (int i = 0; i < n; i++)
+    str[i] = digits[n - 1 - i];
+  str[n] = 0;
+  return str;
+}
+
+size_t Print::write(const char *s)
+{
+  return write((const uint8_t *)s, strlen(s));
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while (size--)
+    n += write(*buffer++);
+  return n;
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  char buf[33];
+  return write(ultoa(n, buf, base));
+}
+
+size_t Print::print(long n, int base)
+{
+  char buf[34];
+  return write(ltoa(n, buf, base));
+}
+
+void FakeSerial::reset()
+{
+  rxLen = rxPos = txLen = 0;
+  txRoom = 63;
+}
+
+void FakeSerial::feed(const uint8_t *data, size_t len)
+{
+  if (rxPos == rxLen)
+    rxPos = rxLen = 0;
+  memcpy(rx + rxLen, data, len);
+  rxLen += len;
+}
+
+int FakeSerial::available()
+{
+  return rxLen - rxPos;
+}
+
+int FakeSerial::read()
+{
+  return rxPos < rxLen ? rx[rxPos++] : -1;
+}
+
+int FakeSerial::availableForWrite()
+{
+  return txRoom;
+}
+
+size_t FakeSerial::write(uint8_t b)
+{
+  if (txLen < sizeof(tx))
+    tx[txLen++] = b;
+  return 1;
+}
@@ -0,0 +1,126 @@
+/**
+ * Host stand-in for the parts of the Arduino core the firmware uses, for the
+ * tests in tests/. Time only moves when the tests move it (fakeAdvance()) or
+ * when the firmware waits (delay(), delayMicroseconds()), and every call of
+ * micros() lets one usec pass so that a loop that waits on it comes to an end.
+ * Pins, analog inputs and the serial port are plain arrays the tests can
+ * set and look at.
+ */
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "Print.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define DEC 10
+#define HEX 16
+#define DEFAULT 1
+#define F_CPU 16000000L
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define A6 20
+#define A7 21
+#define SDA A4
+#define SCL A5
+#define NUM_PINS 22
+
+#define B00000 0
+#define B00001 1
+#define B00010 2
+#define B00011 3
+#define B00100 4
+#define B00101 5
+#define B00110 6
+#define B00111 7
+#define B01000 8
+#define B01100 12
+#define B01111 15
+#define B10000 16
+#define B10100 20
+#define B11000 24
+#define B11011 27
+#define B11100 28
+#define B11110 30
+
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+// with fakePortIo set, pins 8 to 13 are on PORTB as on the Uno, the LCD then
+// writes the port directly, otherwise it falls back to digitalWrite()
+extern bool fakePortIo;
+#define NOT_A_PORT 0
+#define PB 2
+#define digitalPinToPort(p) ((uint8_t)(fakePortIo && (p) >= 8 && (p) <= 13 ? PB : NOT_A_PORT))
+#define digitalPinToBitMask(p) ((uint8_t)(1 << ((p) & 7)))
+#define portOutputRegister(p) (&PORTB)
+
+// time, in usecs since the start
+extern uint32_t fakeMicros;
+void fakeAdvance(uint32_t usecs);
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+extern void (*fakeOnDelay)(); // called on every delayMicroseconds(), to watch the pins
+extern void (*fakeOnMicros)(); // called on every micros() and millis(), to run the hardware meanwhile
+
+// pins
+extern uint8_t fakePins[NUM_PINS];
+extern uint8_t fakePinModes[NUM_PINS];
+extern uint16_t fakeAnalog[NUM_PINS];
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogReference(uint8_t mode);
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration = 0);
+void noTone(uint8_t pin);
+
+char *itoa(int value, char *str, int base);
+char *ltoa(long value, char *str, int base);
+char *ultoa(unsigned long value, char *str, int base);
+
+// the serial port: what the firmware is sent and what it wrote
+class FakeSerial : public Print
+{
+public:
+  void begin(long) {}
+  void flush() {}
+  int available();
+  int read();
+  int availableForWrite();
+  size_t write(uint8_t b);
+  using Print::write;
+
+  void feed(const uint8_t *data, size_t len); // bytes from the host
+  size_t rxLen;
+  size_t rxPos;
+  uint8_t rx[512];
+  size_t txLen;
+  uint8_t tx[4096];
+  int txRoom; // availableForWrite(), 63 like the hardware
+  void reset();
+};
+extern FakeSerial Serial;
+
+#endif
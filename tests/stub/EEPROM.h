@@ -0,0 +1,40 @@
+#ifndef EEPROM_H
+#define EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+// host stand-in for the EEPROM library, 1 kbyte like the ATmega328
+struct EEPROMClass
+{
+  uint8_t data[1024];
+  uint32_t writes; // cells written, to see the wear
+  uint8_t read(int address) { return data[address]; }
+  void write(int address, uint8_t value)
+  {
+    data[address] = value;
+    writes++;
+  }
+  void update(int address, uint8_t value)
+  {
+    if (data[address] != value)
+      write(address, value);
+  }
+  template <typename T>
+  T &get(int address, T &t)
+  {
+    memcpy(&t, data + address, sizeof(T));
+    return t;
+  }
+  template <typename T>
+  const T &put(int address, const T &t)
+  {
+    const uint8_t *p = (const uint8_t *)&t;
+    for (size_t i = 0; i < sizeof(T); i++)
+      update(address + i, p[i]);
+    return t;
+  }
+};
+extern EEPROMClass EEPROM;
+
+#endif
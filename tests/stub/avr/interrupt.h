@@ -0,0 +1,9 @@
+#ifndef AVR_INTERRUPT_H
+#define AVR_INTERRUPT_H
+
+// an interrupt handler is a plain function the tests can call
+#define ISR(vector) extern "C" void vector(void)
+#define cli()
+#define sei()
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef AVR_IO_H
+#define AVR_IO_H
+
+#include <stdint.h>
+
+// the registers the firmware touches, plain variables on the host
+extern volatile uint8_t TWBR, TWCR, TWSR, TWDR;
+extern volatile uint8_t PORTB, PINC, PCICR, PCMSK1;
+extern volatile uint8_t WDTCSR, MCUSR, ADMUX, SREG;
+extern volatile uint16_t SP;
+
+#define TWINT 7
+#define TWSTA 5
+#define TWSTO 4
+#define TWEN 2
+#define TWIE 0
+#define PCIE1 1
+#define PCINT8 0
+#define PCINT9 1
+#define WDIE 6
+#define WDCE 4
+#define WDE 3
+#define WDRF 3
+#define WDP0 0
+#define WDP1 1
+#define WDP2 2
+#define WDP3 5
+#define RAMEND 0x8FF
+#define _BV(bit) (1 << (bit))
+
+#endif
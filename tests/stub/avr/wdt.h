@@ -0,0 +1,9 @@
+#ifndef AVR_WDT_H
+#define AVR_WDT_H
+
+#define WDTO_15MS 0
+#define wdt_reset()
+#define wdt_disable()
+#define wdt_enable(timeout)
+
+#endif
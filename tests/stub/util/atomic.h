@@ -0,0 +1,8 @@
+#ifndef UTIL_ATOMIC_H
+#define UTIL_ATOMIC_H
+
+// nothing interrupts the tests
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_BLOCK(type) for (int atomicOnce = 1; atomicOnce; atomicOnce = 0)
+
+#endif
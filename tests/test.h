@@ -0,0 +1,60 @@
+#ifndef TEST_H
+#define TEST_H
+
+/**
+ * The few checks the host tests need. A failed CHECK prints where and goes
+ * on, main() returns the number of failures.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+static int testFailures = 0;
+
+#define CHECK(cond)                                                   \
+  do                                                                  \
+  {                                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      testFailures++;                                                 \
+    }                                                                 \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                           \
+  do                                                                             \
+  {                                                                              \
+    long long va = (long long)(a), vb = (long long)(b);                          \
+    if (va != vb)                                                                \
+    {                                                                            \
+      printf("%s:%d: %s == %s failed, %lld != %lld\n", __FILE__, __LINE__, #a, \
+             #b, va, vb);                                                        \
+      testFailures++;                                                            \
+    }                                                                            \
+  } while (0)
+
+#define TEST_DONE()                                                   \
+  do                                                                  \
+  {                                                                   \
+    if (testFailures)                                                 \
+      printf("%d check(s) failed\n", testFailures);                   \
+    return testFailures != 0;                                         \
+  } while (0)
+
+// a small reproducible random number generator, the same on every host
+static uint32_t testSeed = 1;
+static uint32_t testRandom()
+{
+  testSeed = testSeed * 1103515245u + 12345u;
+  return testSeed >> 8;
+}
+
+// host time in nsecs, for the timings some tests print
+static uint64_t testNanos()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000u + t.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * The frequency in BCD against printf
+ */
+
+#include "../src/ubitx_bcd.cpp"
+#include "test.h"
+
+// compares the BCD copy digit by digit with the frequency printed in decimal
+static bool matches(uint32_t f)
+{
+  char text[12];
+  uint8_t packed[5] = {0};
+
+  settings.frequency = f;
+  const uint8_t *bcd = bcd_sync();
+  snprintf(text, sizeof(text), "%09lu", (unsigned long)f);
+  for (uint8_t pos = 0; pos < BCD_DIGITS; pos++)
+  {
+    uint8_t d = text[BCD_DIGITS - 1 - pos] - '0';
+    if (bcd_digit(pos) != d)
+    {
+      printf("%lu: digit %u is %u\n", (unsigned long)f, pos, bcd_digit(pos));
+      return false;
+    }
+    if (pos & 1)
+      packed[4 - (pos + 1) / 2] |= d;
+    else
+      packed[4 - pos / 2] |= d << 4;
+  }
+  return memcmp(bcd, packed, 5) == 0;
+}
+
+// user-024: tuning steps up and down, with carries and borrows across decades
+static void testSteps()
+{
+  static const uint32_t steps[] = {1, 10, 50, 100, 1000, 9999, 10000, 100000, 1000000};
+  uint32_t f = 7000000;
+
+  CHECK(matches(f));
+  for (uint16_t i = 0; i < 20000; i++)
+  {
+    uint32_t step = steps[testRandom() % (sizeof(steps) / sizeof(steps[0]))];
+    if (testRandom() & 1)
+      f += step;
+    else if (f >= step)
+      f -= step;
+    if (f > 999999999)
+      f = 999999999;
+    if (!matches(f))
+    {
+      CHECK(false);
+      return;
+    }
+  }
+}
+
+// jumps anywhere, as a band change or a CAT set frequency does
+static void testJumps()
+{
+  static const uint32_t edges[] = {0, 9, 10, 99999999, 100000000, 999999999, 999999990, 1, 30000000};
+
+  for (uint8_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++)
+    CHECK(matches(edges[i]));
+  for (uint16_t i = 0; i < 5000; i++)
+  {
+    uint32_t f = (testRandom() << 8 ^ testRandom()) % 1000000000;
+    if (!matches(f))
+    {
+      CHECK(false);
+      return;
+    }
+  }
+}
+
+// the first four bytes are what writeFreq() puts in a CAT reply
+static void testWriteFreq()
+{
+  static const uint8_t expect[4] = {0x01, 0x40, 0x74, 0x00};
+  uint8_t cmd[5] = {0, 0, 0, 0, 0xAA};
+
+  settings.frequency = 14074000;
+  writeFreq(cmd);
+  CHECK(memcmp(cmd, expect, 4) == 0);
+  CHECK_EQ(cmd[4], 0xAA);
+}
+
+int main()
+{
+  testSteps();
+  testJumps();
+  testWriteFreq();
+  TEST_DONE();
+}
@@ -0,0 +1,430 @@
+/**
+ * The CAT byte parser and the reply ring
+ */
+
+#include "../src/ubitx_cat.cpp"
+#include "test.h"
+
+static const uint8_t getFreq[5] = {0, 0, 0, 0, 0x03};
+static const uint8_t getStatus[5] = {0, 0, 0, 0, 0xF7};
+
+static void reset()
+{
+  Serial.reset();
+  fakeAdvance(1000000L); // well clear of whatever the last test left
+  catReceive();          // sees the port empty and drops any partial frame
+  catHead = catTail = 0;
+  catTxHead = catTxTail = 0;
+  catFill = 0;
+  settings.frequency = 7100000;
+  settings.isUSB = 0;
+  catStateChanged();
+}
+
+static void feed(const uint8_t *frame, uint8_t from, uint8_t to)
+{
+  Serial.feed(frame + from, to - from);
+}
+
+static uint8_t queued()
+{
+  return catHead - catTail;
+}
+
+static bool queuedFrame(uint8_t n, const uint8_t *frame)
+{
+  return memcmp(catQueue[(catTail + n) % CAT_QUEUE_SIZE], frame, 5) == 0;
+}
+
+// user-014: a frame that comes in over several passes of the loop
+static void testSplit()
+{
+  reset();
+  feed(getFreq, 0, 2);
+  catReceive();
+  fakeAdvance(1000);
+  feed(getFreq, 2, 4);
+  catReceive();
+  CHECK_EQ(queued(), 0);
+  fakeAdvance(1000);
+  feed(getFreq, 4, 5);
+  catReceive();
+  CHECK_EQ(queued(), 1);
+  CHECK(queuedFrame(0, getFreq));
+}
+
+// a partial frame is dropped after the timeout, the next frame then parses whole
+static void testTimeout()
+{
+  reset();
+  feed(getStatus, 0, 3); // the last two bytes are lost on the line
+  catReceive();
+  fakeAdvance(2000);
+  catReceive(); // passes of the loop with the port empty, within the timeout...
+  CHECK_EQ(catFill, 3);
+  fakeAdvance(2000 * CAT_BYTE_TIMEOUT);
+  catReceive(); // ...and past it
+  // the next frame and the start of another come in together
+  feed(getFreq, 0, 5);
+  feed(getStatus, 0, 2);
+  catReceive();
+  CHECK_EQ(queued(), 1);
+  CHECK(queuedFrame(0, getFreq));
+  CHECK_EQ(catFill, 2);
+}
+
+// a loop that comes back late never drops bytes that came in on time
+static void testSlowLoop()
+{
+  reset();
+  feed(getFreq, 0, 3);
+  catReceive();
+  feed(getFreq, 3, 5); // the rest of the frame follows at once...
+  fakeAdvance(5000 * CAT_BYTE_TIMEOUT); // ...but the loop is busy elsewhere
+  catReceive();
+  CHECK_EQ(queued(), 1);
+  CHECK(queuedFrame(0, getFreq));
+}
+
+// frames back to back fill the queue, the rest wait in the port
+static void testQueue()
+{
+  reset();
+  for (uint8_t i = 0; i < CAT_QUEUE_SIZE + 2; i++)
+    feed(i & 1 ? getStatus : getFreq, 0, 5);
+  catReceive();
+  CHECK_EQ(queued(), CAT_QUEUE_SIZE);
+  CHECK_EQ(Serial.available(), 10);
+  for (uint8_t i = 0; i < CAT_QUEUE_SIZE; i++)
+    CHECK(queuedFrame(i, i & 1 ? getStatus : getFreq));
+}
+
+// all the frames waiting are answered in one pass, in order
+static void testAnswer()
+{
+  static const uint8_t freq[5] = {0x00, 0x71, 0x00, 0x00, 0x00};
+
+  reset();
+  for (uint8_t i = 0; i < CAT_QUEUE_SIZE + 2; i++)
+    feed(i & 1 ? getStatus : getFreq, 0, 5);
+  checkCAT();
+  CHECK_EQ(queued(), 0);
+  CHECK_EQ(Serial.available(), 0);
+  CHECK_EQ(Serial.txLen, 3 * 5 + 3);
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    CHECK(memcmp(Serial.tx + 6 * i, freq, 5) == 0);
+    CHECK_EQ(Serial.tx[6 * i + 5], 0x88);
+  }
+}
+
+// with the uart full the ring fills, then the frames wait whole in the queue
+static void testHeld()
+{
+  static const uint8_t freq[5] = {0x00, 0x71, 0x00, 0x00, 0x00};
+  const uint8_t frames = 2 * (CAT_TX_SIZE / 5); // twice what the ring takes
+
+  reset();
+  catStreamUnacked = false;
+  catDelayed = catDropped = 0;
+  Serial.txRoom = 0;
+  for (uint8_t i = 0; i < frames; i++)
+    feed(getFreq, 0, 5);
+  checkCAT();
+  // answered while there was room for the longest reply
+  const uint8_t answered = (CAT_TX_SIZE - CAT_REPLY_MAX) / 5 + 1;
+  CHECK(catTxFree() < CAT_REPLY_MAX);
+  CHECK_EQ(catTxFree(), CAT_TX_SIZE - 5 * answered);
+  CHECK_EQ(queued() + Serial.available() / 5, frames - answered);
+  CHECK_EQ(Serial.txLen, 0);
+  checkCAT(); // held again, counted once
+  CHECK_EQ(catDelayed, 1);
+  CHECK_EQ(catDropped, 0);
+
+  // the uart takes bytes again, every reply comes out whole and in order
+  Serial.txRoom = 63;
+  for (uint8_t i = 0; i < 10 && (queued() || Serial.available()); i++)
+    checkCAT();
+  catFlush();
+  CHECK_EQ(queued(), 0);
+  CHECK_EQ(Serial.txLen, 5 * frames);
+  for (uint8_t i = 0; i < frames; i++)
+    CHECK(memcmp(Serial.tx + 5 * i, freq, 5) == 0);
+}
+
+// a reply that doesn't fit is refused whole, what is already queued stays as it was
+static void testOversize()
+{
+  static const uint8_t reply[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+  uint8_t ring[CAT_TX_SIZE];
+
+  reset();
+  catDropped = 0;
+  Serial.txRoom = 0;
+  while (catTxFree() >= sizeof(reply))
+    catSend(reply, sizeof(reply));
+  catSend(reply, catTxFree()); // leaves no room at all
+  memcpy(ring, catTx, sizeof(ring));
+  uint8_t head = catTxHead;
+  catSend(reply, 1);
+  CHECK_EQ(catDropped, 1);
+  CHECK_EQ(catTxHead, head);
+  CHECK(memcmp(ring, catTx, sizeof(ring)) == 0);
+  Serial.txRoom = 63;
+  catFlush();
+  CHECK_EQ(Serial.txLen, CAT_TX_SIZE);
+  CHECK(memcmp(Serial.tx + CAT_TX_SIZE - 8, reply, 8) == 0);
+}
+
+// every reply that goes through the ring is at most CAT_REPLY_MAX, the gate in checkCAT() relies on it
+static void testReplySizes()
+{
+  uint8_t longest = 0;
+
+  for (int op = 0; op < 0x100; op++)
+  {
+    if (op >= 0xD0 && op <= 0xD5 && op != 0xD4)
+      continue; // the diagnostics, they flush the ring and write to the port
+    uint8_t frame[5] = {0, 0, 0, 0, (uint8_t)op};
+    reset();
+    feed(frame, 0, 5);
+    checkCAT();
+    catFlush();
+    if (Serial.txLen > longest)
+      longest = Serial.txLen;
+    CHECK(Serial.txLen <= CAT_REPLY_MAX);
+  }
+  CHECK_EQ(longest, CAT_REPLY_MAX);
+  catStreaming = false;
+  catPushOn = false;
+  reset();
+}
+
+// how many polls a pass answers and what the line allows
+static void timeReplies()
+{
+  const int rounds = 20000;
+  uint8_t polls[CAT_QUEUE_SIZE * 5];
+
+  for (uint8_t i = 0; i < CAT_QUEUE_SIZE; i++)
+    memcpy(polls + 5 * i, i & 1 ? getStatus : getFreq, 5);
+  reset();
+  uint64_t t = testNanos();
+  for (int i = 0; i < rounds; i++)
+  {
+    Serial.reset();
+    Serial.feed(polls, sizeof(polls));
+    checkCAT();
+  }
+  t = testNanos() - t;
+  double perPoll = t / (double)rounds / CAT_QUEUE_SIZE;
+
+  // 0x03 and 0xF7 in turn: 10 bytes in and 6 out for two polls, at 38400 baud 10 bits a byte
+  printf("  cat: %.0f nsecs a poll through checkCAT() (on the host), the line carries %d polls a second\n",
+         perPoll, 2 * 3840 / 10);
+  reset();
+}
+
+static void ask(const uint8_t *frame)
+{
+  Serial.txLen = 0;
+  feed(frame, 0, 5);
+  checkCAT();
+}
+
+// user-017: the polls are answered from the cache until the state changes
+static void testCache()
+{
+  static const uint8_t freq40[5] = {0x00, 0x71, 0x00, 0x00, 0x00};
+  static const uint8_t freq20[5] = {0x01, 0x40, 0x74, 0x00, 0x01};
+
+  reset();
+  ask(getFreq);
+  CHECK(memcmp(Serial.tx, freq40, 5) == 0);
+  ask(getStatus);
+  CHECK_EQ(Serial.tx[0], 0x88);
+
+  settings.frequency = 14074000;
+  settings.isUSB = 1;
+  settings.inTx = 1;
+  ask(getFreq); // nothing said it changed, the cached reply goes out
+  CHECK(memcmp(Serial.tx, freq40, 5) == 0);
+
+  catStateChanged();
+  ask(getFreq);
+  CHECK(memcmp(Serial.tx, freq20, 5) == 0);
+  ask(getStatus);
+  CHECK_EQ(Serial.tx[0], 0x08);
+  settings.inTx = 0;
+  catStateChanged();
+}
+
+// the EEPROM words are kept by address, the oldest goes first
+static void testCacheEeprom()
+{
+  static const uint8_t readB3[5] = {0x00, 0xB3, 0, 0, 0xBB};
+
+  reset();
+  ask(readB3);
+  CHECK_EQ(Serial.txLen, 2);
+  uint8_t next = catCacheNext;
+  ask(readB3);
+  CHECK_EQ(catCacheNext, next); // found in the cache
+  catStateChanged();
+  ask(readB3);
+  CHECK_EQ(catCacheNext, (next + 1) % CAT_CACHE_WORDS); // made again
+}
+
+// when the version wraps no entry made before can pass for current
+static void testCacheWrap()
+{
+  static const uint8_t freq40[5] = {0x00, 0x71, 0x00, 0x00, 0x00};
+  static const uint8_t freq20[5] = {0x01, 0x40, 0x74, 0x00, 0x01};
+  static const uint8_t readB3[5] = {0x00, 0xB3, 0, 0, 0xBB};
+
+  reset();
+  catVersion = 1;
+  ask(getFreq); // cached at version 1
+  ask(readB3);
+  CHECK_EQ(Serial.txLen, 2);
+
+  settings.frequency = 14074000;
+  settings.isUSB = 1;
+  catVersion = 0xFFFF; // as if 65534 changes went by
+  catStateChanged();   // and this one wraps it back to 1
+  CHECK_EQ(catVersion, 1);
+  for (uint8_t i = 0; i < CAT_CACHE_WORDS; i++)
+    CHECK_EQ(catCacheEeprom[i].version, 0);
+  ask(getFreq);
+  CHECK(memcmp(Serial.tx, freq20, 5) == 0);
+}
+
+// nsecs for one reply to the frame, made afresh each time or from the cache
+static double timeReply(const uint8_t *frame, bool fresh)
+{
+  const int rounds = 50000;
+
+  reset();
+  uint64_t t = testNanos();
+  for (int i = 0; i < rounds; i++)
+  {
+    if (fresh)
+      catStateChanged();
+    memcpy(cat, frame, 5);
+    processCATCommand2(cat);
+    catTxHead = catTxTail = 0;
+    Serial.txLen = 0;
+  }
+  t = testNanos() - t;
+
+  if (fresh)
+  { // without what catStateChanged() itself costs
+    uint64_t c = testNanos();
+    for (int i = 0; i < rounds; i++)
+      catStateChanged();
+    t -= testNanos() - c;
+  }
+  return t / (double)rounds;
+}
+
+// what the cache saves on the polls a logger sends all the time
+static void timeCache()
+{
+  static const uint8_t readB3[5] = {0x00, 0xB3, 0, 0, 0xBB};
+  static const struct
+  {
+    const uint8_t *frame;
+    const char *name;
+  } polls[] = {{getFreq, "0x03"}, {getStatus, "0xF7"}, {readB3, "0xBB"}};
+
+  for (uint8_t i = 0; i < 3; i++)
+    printf("  cat: %s reply %.0f nsecs made afresh, %.0f nsecs from the cache (on the host)\n",
+           polls[i].name, timeReply(polls[i].frame, true), timeReply(polls[i].frame, false));
+  reset();
+}
+
+static void streamFrame(uint8_t seq, uint32_t f, bool bad = false)
+{
+  uint8_t frame[7] = {CAT_STREAM_SYNC, seq, (uint8_t)f, (uint8_t)(f >> 8), (uint8_t)(f >> 16), (uint8_t)(f >> 24)};
+
+  for (uint8_t i = 1; i < 6; i++)
+    frame[6] += frame[i];
+  if (bad)
+    frame[6]++;
+  Serial.feed(frame, 7);
+}
+
+// user-020: frequency frames, only the latest applied, acked and back to FT-817
+static void testStream()
+{
+  static const uint8_t streamOn[5] = {1, 1, 0, 0, 0xD7};
+  static const uint8_t garbage[3] = {0x00, 0x13, 0x37};
+
+  reset();
+  catDelayed = catDropped = catStreamReplaced = catStreamBad = 0;
+  feed(streamOn, 0, 5);
+  streamFrame(1, 7074000); // right behind the command
+  checkCAT();
+  CHECK(catStreaming);
+  CHECK_EQ(Serial.txLen, 3);
+  CHECK_EQ(Serial.tx[0], 0x00);
+  CHECK_EQ(settings.frequency, 7074000);
+  CHECK_EQ(Serial.tx[1], CAT_STREAM_SYNC);
+  CHECK_EQ(Serial.tx[2], 1);
+
+  // two frames in one pass, the first is replaced; a bad one and some noise are skipped
+  Serial.txLen = 0;
+  fakeAdvance(1000L * CAT_STREAM_ACK);
+  streamFrame(2, 7075000);
+  Serial.feed(garbage, sizeof(garbage));
+  streamFrame(3, 7076000);
+  streamFrame(4, 9000000, true);
+  checkCAT();
+  CHECK_EQ(settings.frequency, 7076000);
+  CHECK_EQ(catStreamReplaced, 1);
+  CHECK_EQ(catStreamBad, 1);
+  CHECK_EQ(Serial.txLen, 2);
+  CHECK_EQ(Serial.tx[1], 3);
+
+  // no more acks than one every CAT_STREAM_ACK msecs
+  Serial.txLen = 0;
+  streamFrame(5, 7077000);
+  checkCAT();
+  CHECK_EQ(settings.frequency, 7077000);
+  CHECK_EQ(Serial.txLen, 0);
+  fakeAdvance(1000L * CAT_STREAM_ACK);
+  checkCAT();
+  CHECK_EQ(Serial.txLen, 2);
+  CHECK_EQ(Serial.tx[1], 5);
+
+  // out of range is held to the band edges
+  streamFrame(6, 50000000);
+  checkCAT();
+  CHECK_EQ(settings.frequency, HIGHEST_FREQ);
+
+  // a frequency of 0 ends it, the FT-817 command after it is answered
+  streamFrame(7, 0);
+  ask(getStatus);
+  CHECK(!catStreaming);
+  CHECK_EQ(Serial.txLen, 1);
+  CHECK_EQ(Serial.tx[0], 0x88);
+}
+
+int main()
+{
+  testSplit();
+  testTimeout();
+  testSlowLoop();
+  testQueue();
+  testAnswer();
+  testCache();
+  testCacheEeprom();
+  testCacheWrap();
+  testStream();
+  testHeld();
+  testOversize();
+  testReplySizes();
+  timeReplies();
+  timeCache();
+  TEST_DONE();
+}
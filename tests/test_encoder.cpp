@@ -0,0 +1,158 @@
+/**
+ * The encoder decoding in the pin change interrupt
+ */
+
+#include "../src/ubitx_io.cpp"
+#include "test.h"
+
+// moves the phases to state and runs the interrupt like the pin change would
+static void edge(uint8_t state)
+{
+  PINC = (PINC & ~0x03) | state;
+  fakeAdvance(500);
+  PCINT1_vect();
+}
+
+static int drain()
+{
+  int8_t step;
+  uint16_t time;
+  int total = 0;
+
+  while (enc_pop(&step, &time))
+    total += step;
+  return total;
+}
+
+// clockwise the phases run 0, 1, 3, 2 (A leads B)
+static const uint8_t clockwise[4] = {0, 1, 3, 2};
+
+// user-007: every edge of a clean Gray sequence is one step in its direction
+static void testGray()
+{
+  PINC = 0;
+  enc_init();
+  drain();
+
+  for (int i = 1; i <= 8; i++)
+    edge(clockwise[i & 3]);
+  CHECK_EQ(drain(), 8);
+
+  for (int i = 7; i >= 0; i--)
+    edge(clockwise[i & 3]);
+  CHECK_EQ(drain(), -8);
+
+  // the table agrees with itself: reversing any transition negates it
+  for (uint8_t from = 0; from < 4; from++)
+    for (uint8_t to = 0; to < 4; to++)
+      CHECK_EQ(encTable[from << 2 | to], -encTable[to << 2 | from]);
+}
+
+// a bouncing contact and a skipped state give no step
+static void testNoise()
+{
+  PINC = 0;
+  enc_init();
+  drain();
+
+  for (int i = 0; i < 5; i++)
+  {
+    edge(1);
+    edge(0);
+  }
+  CHECK_EQ(drain(), 0);
+
+  edge(3); // both phases at once, the direction is not known
+  CHECK_EQ(drain(), 0);
+  edge(0);
+  CHECK_EQ(drain(), 0);
+}
+
+// a loop that falls behind loses no steps, they are folded into the newest event
+static void testFull()
+{
+  PINC = 0;
+  enc_init();
+  drain();
+
+  uint8_t events = 0;
+  for (int i = 1; i <= 100; i++)
+    edge(clockwise[i & 3]);
+
+  int8_t step;
+  uint16_t time, last = 0;
+  int total = 0;
+  while (enc_pop(&step, &time))
+  {
+    CHECK(events == 0 || (uint16_t)(time - last) < 0x8000); // in time order
+    last = time;
+    total += step;
+    events++;
+  }
+  CHECK_EQ(total, 100);
+  CHECK_EQ(events, ENC_RING_SIZE - 1);
+}
+
+// enc_read() hands out the steps once per window
+static void testRead()
+{
+  simulateIO = 0;
+  PINC = 0;
+  enc_init();
+  drain();
+  enc_read();
+  fakeAdvance(ENC_WINDOW * 1000L);
+  enc_read();
+
+  for (int i = 1; i <= 6; i++)
+    edge(clockwise[i & 3]);
+  CHECK_EQ(enc_read(), 0); // the window is still open
+  fakeAdvance(ENC_WINDOW * 1000L);
+  CHECK_EQ(enc_read(), 6);
+  fakeAdvance(ENC_WINDOW * 1000L);
+  CHECK_EQ(enc_read(), 0);
+}
+
+// a new reader doesn't get the turns counted for the last one
+static void testReset()
+{
+  simulateIO = 0;
+  PINC = 0;
+  enc_init();
+  drain();
+  enc_read();
+  fakeAdvance(ENC_WINDOW * 1000L);
+  enc_read();
+
+  // counted into the window of one reader, and some left in the ring
+  for (int i = 1; i <= 5; i++)
+    edge(clockwise[i & 3]);
+  CHECK_EQ(enc_read(), 0);
+  for (int i = 6; i <= 8; i++)
+    edge(clockwise[i & 3]);
+
+  enc_reset(); // a menu opens
+  fakeAdvance(ENC_WINDOW * 1000L);
+  CHECK_EQ(enc_read(), 0);
+
+  // the window starts with the new reader, not with the old one
+  for (int i = 1; i <= 4; i++)
+    edge(clockwise[i & 3]);
+  enc_reset();
+  for (int i = 5; i <= 6; i++)
+    edge(clockwise[i & 3]);
+  CHECK_EQ(enc_read(), 0);
+  fakeAdvance(ENC_WINDOW * 1000L);
+  CHECK_EQ(enc_read(), 2);
+}
+
+int main()
+{
+  Serial.reset();
+  testGray();
+  testNoise();
+  testFull();
+  testRead();
+  testReset();
+  TEST_DONE();
+}
@@ -0,0 +1,162 @@
+/**
+ * The interrupt driven i2c queue
+ */
+
+#include "../src/ubitx_i2c.cpp"
+#include "twi.h"
+
+static void write(uint8_t reg, uint8_t a, uint8_t b)
+{
+  uint8_t vals[2] = {a, b};
+  i2cQueueWrite(0x60, reg, vals, 2);
+}
+
+// user-005: the writes come out in order, back to back, and nothing waits for them
+static void testQueue()
+{
+  memset(chipRegs, 0, sizeof(chipRegs));
+  chipTransactions = 0;
+
+  write(10, 1, 2);
+  CHECK(i2cBusy()); // queued and started, not sent
+  CHECK_EQ(chipRegs[10], 0);
+  write(11, 3, 4); // overwrites register 11 after the first write
+  write(20, 5, 6);
+  twiRun();
+  CHECK(!i2cBusy());
+  CHECK_EQ(chipTransactions, 3);
+  CHECK_EQ(chipRegs[10], 1);
+  CHECK_EQ(chipRegs[11], 3);
+  CHECK_EQ(chipRegs[12], 4);
+  CHECK_EQ(chipRegs[20], 5);
+  CHECK_EQ(chipRegs[21], 6);
+
+  // the queue wraps around many times
+  for (int i = 0; i < 200; i++)
+  {
+    write(i & 0x7F, i, i + 1);
+    twiRun();
+    CHECK_EQ(chipRegs[i & 0x7F], (uint8_t)i);
+  }
+}
+
+// a refused transaction is dropped whole and the ones behind it still go out
+static void testNack()
+{
+  memset(chipRegs, 0, sizeof(chipRegs));
+  uint8_t errors = i2cErrors;
+
+  write(30, 1, 2);
+  write(40, 3, 4);
+  write(50, 5, 6);
+  twiRun(1);
+  CHECK_EQ(i2cErrors, errors + 1);
+  CHECK_EQ(chipRegs[30], 1);
+  CHECK_EQ(chipRegs[40], 0);
+  CHECK_EQ(chipRegs[41], 0);
+  CHECK_EQ(chipRegs[50], 5);
+  CHECK_EQ(chipRegs[51], 6);
+  CHECK(!i2cBusy());
+}
+
+static uint8_t block[I2C_MAX_WRITE + 1];
+
+static void writeBlock(uint8_t reg, uint8_t n, uint8_t seed)
+{
+  for (uint8_t i = 0; i < n; i++)
+    block[i] = seed + i;
+  i2cQueueWrite(0x60, reg, block, n);
+}
+
+// the loop is only held while a write is copied, Wire held it until the write was on the bus
+static void testStall()
+{
+  twiRun();
+  // a band change: the three output msynths in one burst, the clock controls and enables
+  uint32_t start = fakeMicros;
+  writeBlock(42, 24, 1);
+  writeBlock(16, 3, 0x0C);
+  writeBlock(3, 1, 0);
+  uint32_t held = fakeMicros - start;
+  busBytes = 0;
+  twiRun();
+  uint32_t bus = busBytes * TWI_BYTE_USEC;
+  printf("  i2c: a band change holds the loop %u usecs, the bus is busy %u usecs"
+         " (a blocking write held it %u usecs at 400 khz, %u at Wire's 100 khz)\n",
+         held, bus, bus, busBytes * 90);
+  CHECK(held * 10 < bus);
+  CHECK_EQ(chipRegs[42], 1);
+  CHECK_EQ(chipRegs[65], 24);
+
+  // more than the queue holds: the loop waits for the part that doesn't fit, and no longer
+  twiLive(true);
+  start = fakeMicros;
+  busBytes = 0;
+  writeBlock(100, 40, 100);
+  writeBlock(150, 40, 150);
+  writeBlock(200, 40, 200);
+  held = fakeMicros - start;
+  twiLive(false);
+  uint32_t sent = busBytes;
+  twiRun();
+  printf("  i2c: 129 bytes through the 64 byte queue hold the loop %u usecs, %u bytes went out meanwhile\n",
+         held, sent);
+  CHECK(held <= (sent + 2) * TWI_BYTE_USEC);
+  CHECK(held < I2C_TIMEOUT_USEC);
+  CHECK_EQ(chipRegs[100], 100);
+  CHECK_EQ(chipRegs[189], 189);
+  CHECK_EQ(chipRegs[239], 239);
+}
+
+// a bus that doesn't move is reset after I2C_TIMEOUT_USEC, the writes are lost and counted
+static void testStuck()
+{
+  uint8_t errors = i2cErrors;
+
+  twiRun();
+  writeBlock(100, 40, 1); // started, but the bus never answers
+  uint32_t start = fakeMicros;
+  writeBlock(150, 40, 2);
+  uint32_t held = fakeMicros - start;
+  CHECK(held >= I2C_TIMEOUT_USEC);
+  CHECK(held < I2C_TIMEOUT_USEC + 100);
+  CHECK_EQ(i2cErrors, (uint8_t)(errors + 2)); // the queue and the write that waited
+  CHECK(!i2cBusy());
+
+  // the next write goes out as usual
+  memset(chipRegs, 0, sizeof(chipRegs));
+  write(10, 7, 8);
+  twiRun();
+  CHECK_EQ(chipRegs[10], 7);
+  CHECK_EQ(chipRegs[150], 0);
+
+  // i2cFlush() gives up the same way
+  errors = i2cErrors;
+  write(10, 9, 9);
+  start = fakeMicros;
+  i2cFlush();
+  CHECK(fakeMicros - start >= I2C_TIMEOUT_USEC);
+  CHECK_EQ(i2cErrors, (uint8_t)(errors + 1));
+  CHECK(!i2cBusy());
+  twiRun();
+  CHECK_EQ(chipRegs[10], 7);
+
+  // a write longer than the queue can ever hold is refused at once
+  errors = i2cErrors;
+  writeBlock(0, I2C_MAX_WRITE + 1, 0);
+  CHECK_EQ(i2cErrors, (uint8_t)(errors + 1));
+  CHECK(!i2cBusy());
+  writeBlock(0, I2C_MAX_WRITE, 0); // the longest there is fits
+  twiRun();
+  CHECK_EQ(chipRegs[I2C_MAX_WRITE - 1], I2C_MAX_WRITE - 1);
+}
+
+int main()
+{
+  i2cInit(); // nothing is queued yet, it must not wait
+  testQueue();
+  testNack();
+  testStall();
+  testStuck();
+  TEST_DONE();
+}
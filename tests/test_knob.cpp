@@ -0,0 +1,135 @@
+/**
+ * The tuning knob acceleration
+ */
+
+#include "../src/ubitx_knob.cpp"
+#include "test.h"
+
+extern "C" void PCINT1_vect(void);
+extern bool simulateIO;
+
+static const knobCurve_t curve[] = {
+    {62, 4000},         // under 4 msec between edges
+    {234, 20},          // under 15 msec
+    {KNOB_SLOWEST, 1}}; // a unit per click
+
+static const knobCurve_t other[] = {
+    {KNOB_SLOWEST, 1}};
+
+static const uint8_t clockwise[4] = {0, 1, 3, 2};
+static uint8_t phase = 0;
+
+// turns the knob by edges, usecs apart
+static void turn(int edges, uint32_t usecs)
+{
+  for (int i = 0; i < (edges < 0 ? -edges : edges); i++)
+  {
+    phase = (phase + (edges < 0 ? 3 : 1)) & 3;
+    fakeAdvance(usecs);
+    PINC = (PINC & ~0x03) | clockwise[phase];
+    PCINT1_vect();
+  }
+}
+
+// lets the knob come to rest and starts with nothing left over
+static void rest()
+{
+  fakeAdvance((KNOB_IDLE + 1) * 1000L);
+  knob_read(other);
+  knob_read(curve);
+}
+
+// user-008: slow clicks move a unit each, a fast spin takes bigger steps
+static void testSpeed()
+{
+  rest();
+  turn(4, 100000); // a click, a tenth of a second per edge
+  CHECK_EQ(knob_read(curve), 1);
+  CHECK_EQ(knob_step(), 1);
+
+  turn(-8, 100000);
+  CHECK_EQ(knob_read(curve), -2);
+
+  // spun fast the filter comes down to the fast end of the curve
+  rest();
+  int32_t total = 0;
+  for (int i = 0; i < 20; i++)
+  {
+    turn(4, 2000);
+    total += knob_read(curve);
+  }
+  CHECK(total > 80 * 100); // well past a unit per click
+  CHECK_EQ(knob_step(), 1000);
+
+  // turning back starts slow again
+  turn(-1, 2000);
+  turn(-3, 2000);
+  CHECK(knob_read(curve) > -4);
+}
+
+// the quarter units left over are not handed to the next user of the knob
+static void testResidue()
+{
+  rest();
+  turn(3, 100000); // three quarters of a click
+  CHECK_EQ(knob_read(curve), 0);
+  CHECK_EQ(knob_read(other), 0);
+  turn(1, 100000);
+  CHECK_EQ(knob_read(other), 0); // a quarter only, the three went with the old curve
+  turn(3, 100000);
+  CHECK_EQ(knob_read(other), 1);
+}
+
+// a slow click takes four edges whichever way it is turned
+static void testSymmetry()
+{
+  rest();
+  turn(3, 100000);
+  CHECK_EQ(knob_read(curve), 0);
+  turn(1, 100000);
+  CHECK_EQ(knob_read(curve), 1);
+
+  rest();
+  turn(-1, 100000);
+  CHECK_EQ(knob_read(curve), 0); // used to step at once
+  turn(-2, 100000);
+  CHECK_EQ(knob_read(curve), 0);
+  turn(-1, 100000);
+  CHECK_EQ(knob_read(curve), -1);
+
+  // a part click turned back is nothing, and the clicks stay where they were
+  turn(-3, 100000);
+  CHECK_EQ(knob_read(curve), 0);
+  turn(3, 100000);
+  CHECK_EQ(knob_read(curve), 0);
+  turn(4, 100000);
+  CHECK_EQ(knob_read(curve), 1);
+  turn(-4, 100000);
+  CHECK_EQ(knob_read(curve), -1);
+}
+
+// a spin after a pause is fast from its second edge, not after a few dozen
+static void testStart()
+{
+  rest();
+  turn(4, 2000);
+  CHECK(knob_read(curve) > 2000);
+  CHECK_EQ(knob_step(), 1000);
+
+  // a slow click after a pause is still a unit
+  rest();
+  turn(4, 100000);
+  CHECK_EQ(knob_read(curve), 1);
+}
+
+int main()
+{
+  simulateIO = 0;
+  PINC = 0;
+  enc_init();
+  testSpeed();
+  testResidue();
+  testSymmetry();
+  testStart();
+  TEST_DONE();
+}
@@ -0,0 +1,186 @@
+/**
+ * The LCD driver and the display framebuffer
+ */
+
+#include "../src/ubitx_ui.cpp"
+#include "hd44780.h"
+#include "test.h"
+
+// sends the same text through one wiring or the other
+static void writeText(bool portIo)
+{
+  LiquidCrystal lcd(8, 9, 10, 11, 12, 13);
+
+  fakePortIo = portIo;
+  glassReset();
+  PORTB = 0xC0; // bits the display doesn't use
+  lcd.begin(16, 2);
+  lcd.clear();
+  lcd.print("Fast IO");
+  lcd.setCursor(3, 1);
+  lcd.print("73");
+}
+
+// user-021: the port path puts the same bytes on the bus as digitalWrite()
+static void testPortIo()
+{
+  writeText(false);
+  uint16_t commands = glass.commands;
+  CHECK(glassShows(0, "Fast IO"));
+  CHECK(glassShows(1, "   73"));
+  CHECK_EQ(glass.data, 9);
+
+  writeText(true);
+  CHECK(glassShows(0, "Fast IO"));
+  CHECK(glassShows(1, "   73"));
+  CHECK_EQ(glass.data, 9);
+  CHECK_EQ(glass.commands, commands);
+  CHECK_EQ(PORTB & 0xC0, 0xC0);
+  for (uint8_t pin = 8; pin <= 13; pin++)
+    CHECK_EQ(fakePins[pin], LOW); // nothing went through digitalWrite()
+  fakePortIo = false;
+}
+
+// other wirings use digitalWrite()
+static void testOtherWiring()
+{
+  LiquidCrystal lcd(8, 9, 10, 11, 13, 12); // d2 and d3 swapped
+
+  fakePortIo = true;
+  glassReset();
+  lcd.begin(16, 2);
+  CHECK_EQ(PORTB, 0);
+  fakePortIo = false;
+}
+
+static uint16_t sent()
+{
+  return glass.commands + glass.data;
+}
+
+static bool glassShowsFrame()
+{
+  return memcmp(glass.ddram, lcdFrame[0], 16) == 0 && memcmp(glass.ddram + 0x40, lcdFrame[1], 16) == 0;
+}
+
+// user-022: only the cells that changed go out
+static void testDiff()
+{
+  glassReset();
+  initDisplay();
+  printLine(1, "A 7.100.00 LSB");
+  printLine(0, "hello");
+  displaySync();
+  CHECK(glassShowsFrame());
+
+  // the same again costs nothing
+  uint16_t before = sent();
+  printLine(1, "A 7.100.00 LSB");
+  printLine(0, "hello");
+  displaySync();
+  CHECK_EQ(sent(), before);
+
+  // one digit is one cursor move and one character
+  glass.commands = glass.data = 0;
+  printLine(1, "A 7.100.50 LSB");
+  displaySync();
+  CHECK_EQ(glass.commands, 1);
+  CHECK_EQ(glass.data, 1);
+  CHECK(glassShowsFrame());
+
+  // a single unchanged cell between two changes is written over, not jumped
+  glass.commands = glass.data = 0;
+  printLine(1, "A 7.101.40 LSB");
+  displaySync();
+  CHECK_EQ(glass.commands, 1);
+  CHECK_EQ(glass.data, 3);
+  CHECK(glassShowsFrame());
+
+  // the CAT indicator sits over the last cell and gives it back
+  printActivity(true);
+  displaySync();
+  CHECK_EQ(glass.ddram[15], '*');
+  printActivity(false);
+  displaySync();
+  CHECK(glassShowsFrame());
+}
+
+// a pass of the display task sends a cell or two, never the whole line
+static void testSlice()
+{
+  glassReset();
+  initDisplay();
+  displaySync();
+  uint16_t before = sent();
+  printLine(0, "a new message...");
+  displayFlush();
+  CHECK(sent() - before >= 1);
+  CHECK(sent() - before <= 2);
+  displaySync();
+  CHECK(glassShowsFrame());
+}
+
+// clear and home take 1.52 msecs, the fast path still waits them out
+static void testSlowCommands()
+{
+  LiquidCrystal lcd(8, 9, 10, 11, 12, 13);
+
+  for (uint8_t portIo = 0; portIo < 2; portIo++)
+  {
+    fakePortIo = portIo;
+    glassReset();
+    lcd.begin(16, 2);
+    lcd.print("x");
+    lcd.clear();
+    lcd.print("after clear");
+    lcd.home();
+    lcd.print("A");
+    CHECK(glassShows(0, "After clear"));
+    CHECK_EQ(glass.early, 0);
+  }
+  fakePortIo = false;
+}
+
+// what a message line costs: the framebuffer write and the bytes to the display
+static void timePrintLine()
+{
+  const int rounds = 100000;
+  static const char *lines[2] = {"A 7.100.00 LSB", "B 14.074.00 USB"};
+
+  glassReset();
+  initDisplay();
+  displaySync();
+
+  uint64_t t = testNanos();
+  for (int i = 0; i < rounds; i++)
+    printLine(1, lines[i & 1]);
+  t = testNanos() - t;
+
+  printLine(1, lines[0]);
+  displaySync();
+  uint32_t start = fakeMicros;
+  printLine(1, lines[1]);
+  displaySync();
+  uint32_t whole = fakeMicros - start;
+  start = fakeMicros;
+  printLine(1, "B 14.074.50 USB");
+  displaySync();
+  uint32_t digit = fakeMicros - start;
+  CHECK(glassShowsFrame());
+  CHECK_EQ(glass.early, 0);
+
+  printf("  lcd: printLine() %.0f nsecs (on the host); to the display a new line takes %u usecs,"
+         " one digit %u usecs\n",
+         t / (double)rounds, whole, digit);
+}
+
+int main()
+{
+  testPortIo();
+  testOtherWiring();
+  testDiff();
+  testSlice();
+  testSlowCommands();
+  timePrintLine();
+  TEST_DONE();
+}
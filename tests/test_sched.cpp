@@ -0,0 +1,126 @@
+/**
+ * The cooperative scheduler
+ */
+
+#include "../src/ubitx_sched.cpp"
+#include "test.h"
+
+static char order[64];
+static uint8_t orderLen = 0;
+
+static void note(char c)
+{
+  if (orderLen < sizeof(order) - 1)
+    order[orderLen++] = c;
+  order[orderLen] = 0;
+}
+
+static void fast() { note('f'); }
+static void slow() { note('s'); }
+static void waiter()
+{ // a task that waits, as a menu does
+  note('w');
+  sched_yield();
+  note('W');
+}
+static void yielder()
+{
+  note('y');
+  sched_yield(); // never runs itself again from in here
+}
+
+static const task_t tasks[] = {
+    // run, period, deadline, priority, flags
+    {slow, 100, 1000, 3, 0},
+    {yielder, 0, 10, 1, TASK_YIELD},
+    {waiter, 50, 100, 2, 0},
+    {fast, 0, 10, 0, 0}};
+
+static void reset()
+{
+  fakeMicros = 0;
+  sched_init(tasks, sizeof(tasks) / sizeof(tasks[0]));
+  orderLen = 0;
+  order[0] = 0;
+}
+
+// user-009: the most urgent first, each at its period
+static void testOrder()
+{
+  reset();
+  sched_run();
+  // everything is due at the start; the waiter's yield runs the yielder again
+  CHECK(strcmp(order, "fywyWs") == 0);
+
+  orderLen = 0;
+  sched_run();
+  CHECK(strcmp(order, "fy") == 0);
+
+  orderLen = 0;
+  fakeAdvance(50000L);
+  sched_run();
+  CHECK(strcmp(order, "fywyW") == 0);
+
+  orderLen = 0;
+  fakeAdvance(50000L);
+  sched_run();
+  CHECK(strcmp(order, "fywyWs") == 0);
+}
+
+// lateness and misses are kept for each task
+static void testLate()
+{
+  reset();
+  sched_run();
+  fakeAdvance(2000000L); // two seconds without a pass
+  sched_run();
+  CHECK(sched_late(0) >= 1900);
+  CHECK_EQ(sched_misses(0), 1);
+  CHECK_EQ(sched_misses(3), 1);
+  CHECK_EQ(sched_current(), 0xFF);
+  CHECK_EQ(sched_late(12), 0); // no such task
+}
+
+static void radio() { note('r'); }
+static void screen() { note('d'); }
+
+static const task_t waits[] = {
+    {radio, 0, 10, 0, TASK_YIELD | TASK_RADIO}, // the keyer or CAT
+    {screen, 0, 50, 1, TASK_YIELD}};            // the display
+
+// a held task doesn't run from a wait or the main loop, the others do
+static void testHold()
+{
+  fakeMicros = 0;
+  sched_init(waits, sizeof(waits) / sizeof(waits[0]));
+  orderLen = 0;
+  sched_yield();
+  CHECK(strcmp(order, "rd") == 0);
+
+  uint8_t held = sched_hold(TASK_RADIO);
+  CHECK_EQ(held, 0);
+  orderLen = 0;
+  sched_yield();
+  sched_run();
+  CHECK(strcmp(order, "dd") == 0);
+
+  // held again from inside, as the alignment calls the calibration
+  uint8_t inner = sched_hold(TASK_RADIO);
+  sched_hold(inner);
+  orderLen = 0;
+  sched_yield();
+  CHECK(strcmp(order, "d") == 0);
+
+  sched_hold(held);
+  orderLen = 0;
+  sched_yield();
+  CHECK(strcmp(order, "rd") == 0);
+}
+
+int main()
+{
+  testOrder();
+  testLate();
+  testHold();
+  TEST_DONE();
+}
@@ -0,0 +1,303 @@
+/**
+ * The Si5351 driver against a chip that keeps whatever is written to it
+ */
+
+#include "../src/ubitx_si5351.cpp"
+#include "twi.h"
+#include <math.h>
+
+// the registers that a driver without a mirror would end up with for the same clocks
+static void freshRegisters(uint8_t *regs, const uint32_t *fout)
+{
+  memset(si5351bx_known, 0, sizeof(si5351bx_known));
+  memset(si5351bx_div, 0, sizeof(si5351bx_div));
+  for (uint8_t clk = 0; clk < 3; clk++)
+    si5351bx_stage(clk, fout[clk]);
+  si5351bx_commit();
+  twiRun();
+  memcpy(regs, chipRegs, sizeof(chipRegs));
+}
+
+// user-001: only the bytes that changed go out, and the chip ends up right
+static void testShadow()
+{
+  uint32_t fout[3] = {11052000, 56057000, 52155000};
+  uint8_t regs[256];
+
+  initOscillators(0);
+  twiRun();
+  for (uint8_t clk = 0; clk < 3; clk++)
+    si5351bx_stage(clk, fout[clk]);
+  si5351bx_commit();
+  twiRun();
+
+  // the same frequencies again send nothing at all
+  chipBytes = 0;
+  chipTransactions = 0;
+  for (uint8_t clk = 0; clk < 3; clk++)
+    si5351bx_stage(clk, fout[clk]);
+  si5351bx_commit();
+  twiRun();
+  CHECK_EQ(chipTransactions, 0);
+  CHECK_EQ(chipBytes, 0);
+
+  // a tuning step rewrites part of one msynth, not the 8 bytes of all three
+  // (without the mirror every step was 3 transactions of 10 register bytes in all)
+  for (int32_t size = 50; size <= 1000; size += 950)
+  {
+    uint32_t bytes = 0;
+    chipTransactions = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+      fout[2] += size == 50 ? (testRandom() & 1 ? 50 : -50) : (int32_t)(testRandom() % 2001) - 1000;
+      chipBytes = 0;
+      si5351bx_setfreq(2, fout[2]);
+      twiRun();
+      CHECK(chipBytes <= 8);
+      bytes += chipBytes;
+    }
+    printf("  si5351: steps of up to %u hz send %u.%u bytes in %u.%u transactions (10 in 3 without the mirror)\n",
+           (unsigned)size, bytes / 1000, bytes / 100 % 10, chipTransactions / 1000, chipTransactions / 100 % 10);
+    CHECK(bytes < 1000 * 8);
+    CHECK(chipTransactions < 1000 * 3 / 2);
+  }
+
+  // and the chip holds what a full write of every register would leave
+  uint8_t chip[256];
+  memcpy(chip, chipRegs, sizeof(chip));
+  freshRegisters(regs, fout);
+  CHECK(memcmp(chip + 16, regs + 16, 3) == 0);
+  CHECK(memcmp(chip + 34, regs + 34, 32) == 0);
+  CHECK_EQ(chip[3], regs[3]);
+}
+
+// the tuning range of the radio
+#define TEST_FMIN 100000
+#define TEST_FMAX 30000000
+
+// the next frequency of a random walk over the tuning range
+static uint32_t walk(uint32_t fout)
+{
+  uint32_t r = testRandom();
+  if (r % 1000 == 0)
+    fout = TEST_FMIN + r % (TEST_FMAX - TEST_FMIN); // now and then a jump anywhere
+  else if (r % 10 == 0)
+    fout += (int32_t)(r % 65535) - 32767;
+  else
+    fout += ((int32_t)(r % 201) - 100) * 10;
+  if (fout < TEST_FMIN || fout > TEST_FMAX)
+    fout = TEST_FMIN + r % (TEST_FMAX - TEST_FMIN);
+  return fout;
+}
+
+// user-003: a divider moved by additions is the one the full divide gives
+static void testIncremental()
+{
+  si5351bx_div_t step, full;
+  uint32_t fout = 7000000;
+  uint32_t incremental = 0;
+
+  si5351bx_divfull(&step, fout);
+  for (long i = 0; i < 400000; i++)
+  {
+    fout = walk(fout);
+    if (si5351bx_divstep(&step, fout))
+      incremental++;
+    else
+      si5351bx_divfull(&step, fout);
+    si5351bx_divfull(&full, fout);
+    CHECK_EQ(step.fout, full.fout);
+    CHECK_EQ(step.msq, full.msq);
+    CHECK_EQ(step.msr, full.msr);
+    if (testFailures)
+      return;
+  }
+  // the tuning steps above the SI5351BX_INC_MAXQ limit take the short path
+  CHECK(incremental > 100000);
+
+  // around the limit and at the bottom of the range, where msq is largest
+  static const uint32_t edges[] = {TEST_FMIN, 500000, 6830000, 6840000, 6850000};
+  for (uint8_t e = 0; e < sizeof(edges) / sizeof(edges[0]); e++)
+  {
+    fout = edges[e];
+    si5351bx_divfull(&step, fout);
+    for (int i = 0; i < 2000; i++)
+    {
+      fout += (int32_t)(testRandom() % 2001) - 1000;
+      if (fout < TEST_FMIN)
+        fout = TEST_FMIN;
+      if (!si5351bx_divstep(&step, fout))
+      {
+        CHECK(step.msq > SI5351BX_INC_MAXQ || step.fout != fout);
+        si5351bx_divfull(&step, fout);
+      }
+      si5351bx_divfull(&full, fout);
+      CHECK_EQ(step.msq, full.msq);
+      CHECK_EQ(step.msr, full.msr);
+    }
+  }
+  if (testFailures)
+    return;
+
+  // and what goes to the chip is the same as well
+  uint8_t regs[256];
+  uint32_t clocks[3] = {11052000, 56057000, 52155000};
+  initOscillators(0);
+  twiRun();
+  for (int i = 0; i < 1000; i++)
+  {
+    clocks[2] += ((int32_t)(testRandom() % 201) - 100) * 10;
+    si5351bx_setfreq(2, clocks[2]);
+    twiRun();
+  }
+  uint8_t chip[256];
+  memcpy(chip, chipRegs, sizeof(chip));
+  freshRegisters(regs, clocks);
+  CHECK(memcmp(chip + 50, regs + 50, 8) == 0);
+}
+
+// user-006: a bank brings back the registers and the dividers behind them
+static void testBanks()
+{
+  si5351bx_bank_t rx, tx;
+  uint32_t fout = 56057000;
+
+  si5351bx_pllvfo = false;
+  initOscillators(0);
+  twiRun();
+  si5351bx_stage(0, 11052000);
+  si5351bx_stage(1, 56057000);
+  si5351bx_stage(2, fout);
+  si5351bx_commit();
+  twiRun();
+  si5351bx_save(&rx);
+  uint8_t rxRegs[256];
+  memcpy(rxRegs, chipRegs, sizeof(rxRegs));
+
+  si5351bx_stage(2, fout + 700);
+  si5351bx_commit();
+  twiRun();
+  si5351bx_save(&tx);
+
+  // nothing on PLLB when CLK2 doesn't run from it, and only what differs
+  memset(chipRegs + 34, 0xAA, 8);
+  chipBytes = 0;
+  CHECK(si5351bx_load(&rx));
+  si5351bx_commit();
+  twiRun();
+  for (uint8_t i = 34; i < 42; i++)
+    CHECK_EQ(chipRegs[i], 0xAA);
+  CHECK(chipBytes <= 8);
+  CHECK(memcmp(chipRegs + 50, rxRegs + 50, 8) == 0);
+
+  // the divider is the receive one again, so the next step is a short one
+  CHECK_EQ(si5351bx_div[2].fout, fout);
+  si5351bx_div_t before = si5351bx_div[2];
+  CHECK(si5351bx_divstep(&before, fout + 10));
+  CHECK(si5351bx_load(&tx));
+  CHECK_EQ(si5351bx_div[2].fout, fout + 700);
+
+  // a bank made with another calibration is refused
+  si5351_set_calibration(100);
+  CHECK(!si5351bx_load(&rx));
+  si5351_set_calibration(0);
+}
+
+// the time of a 50 hz tuning step both ways, on the host
+static volatile uint32_t timeSink;
+
+static void timeIncremental()
+{
+  static si5351bx_div_t divs[1000];
+  static uint32_t fouts[1000];
+  const int rounds = 200;
+  uint32_t fout = 15000000;
+
+  for (int i = 0; i < 1000; i++)
+  {
+    fout += ((int32_t)(testRandom() % 201) - 100) * 10;
+    fouts[i] = fout;
+  }
+
+  uint64_t start = testNanos();
+  for (int r = 0; r < rounds; r++)
+    for (int i = 0; i < 1000; i++)
+    {
+      si5351bx_divfull(&divs[i], fouts[i] - (r & 1) * 50);
+      timeSink += divs[i].msr;
+    }
+  uint64_t full = testNanos() - start;
+
+  // up 50 hz on even rounds and back down on odd ones
+  for (int i = 0; i < 1000; i++)
+    si5351bx_divfull(&divs[i], fouts[i] - 50);
+  start = testNanos();
+  for (int r = 0; r < rounds; r++)
+    for (int i = 0; i < 1000; i++)
+    {
+      if (!si5351bx_divstep(&divs[i], fouts[i] - (r & 1) * 50))
+        CHECK(false);
+      timeSink += divs[i].msr;
+    }
+  uint64_t inc = testNanos() - start;
+
+  printf("  si5351: full divide %.1f nsecs, incremental step %.1f nsecs (on the host)\n",
+         full / (rounds * 1000.0), inc / (rounds * 1000.0));
+}
+
+// the multiplier a + b/c of the 8 registers of a pll or msynth
+static double unpack(const uint8_t *vals)
+{
+  uint32_t p1 = (uint32_t)(vals[2] & 0x03) << 16 | (uint32_t)vals[3] << 8 | vals[4];
+  uint32_t p2 = (uint32_t)(vals[5] & 0x0F) << 16 | (uint32_t)vals[6] << 8 | vals[7];
+  uint32_t p3 = (uint32_t)(vals[5] >> 4) << 16 | (uint32_t)vals[0] << 8 | vals[1];
+  return (p1 + 512 + (double)p2 / p3) / 128;
+}
+
+// user-004: CLK2 from PLLB is never further off than half a step of the pll fraction
+static void testPllVfo()
+{
+  double worst = 0;
+  uint32_t worstAt = 0;
+  uint32_t fout = SI5351BX_VFO_FMIN;
+
+  si5351bx_pllvfo = true;
+  si5351bx_vfodiv = 0;
+  while (fout <= SI5351BX_VFO_FMAX)
+  {
+    si5351bx_stage(2, fout);
+    CHECK(si5351bx_ctrl[2] & 0x20); // from PLLB
+    double div = unpack(si5351bx_image + 24);
+    double vco = si5351bx_xtal * unpack(si5351bx_image);
+    CHECK(vco >= SI5351BX_VCO_MIN && vco <= SI5351BX_VCO_MAX);
+    double error = fabs(vco / div - fout);
+    // half of xtal/c at the vco, through the output divider
+    if (error > si5351bx_xtal / (2.0 * SI5351BX_PLL_C) / div + 0.001)
+    {
+      CHECK(false);
+      printf("%u hz is %.3f hz off\n", fout, error);
+      break;
+    }
+    if (error > worst)
+    {
+      worst = error;
+      worstAt = fout;
+    }
+    fout += 1 + testRandom() % 199;
+  }
+  printf("  si5351: pll vfo mode is at most %.2f hz off (at %u hz)\n", worst, worstAt);
+  CHECK(worst < 1.2);
+  si5351bx_pllvfo = PLL_VFO_MODE;
+  si5351bx_vfodiv = 0;
+  si5351bx_staged = 0; // only looked at, never sent
+}
+
+int main()
+{
+  testShadow();
+  testIncremental();
+  timeIncremental();
+  testBanks();
+  testPllVfo();
+  TEST_DONE();
+}
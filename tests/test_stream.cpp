@@ -0,0 +1,118 @@
+/**
+ * CAT frequency streaming through the whole loop
+ */
+
+#include "../src/ubitx_main.cpp"
+#include "twi.h"
+
+#define LINE_USEC 260 // a byte at 38400 baud, 10 bits
+#define STREAM_SYNC 0xA5
+
+static uint8_t line[16384]; // what the computer sends
+static size_t lineLen, linePos;
+static uint32_t lineNext;
+
+static void frame(uint8_t seq, uint32_t f)
+{
+  uint8_t *p = line + lineLen;
+
+  p[0] = STREAM_SYNC;
+  p[1] = seq;
+  p[2] = f;
+  p[3] = f >> 8;
+  p[4] = f >> 16;
+  p[5] = f >> 24;
+  p[6] = 0;
+  for (uint8_t i = 1; i < 6; i++)
+    p[6] += p[i];
+  lineLen += 7;
+}
+
+// the bus runs, and the bytes come in at the line rate
+static void lineTick()
+{
+  twiTick();
+  while (linePos < lineLen && fakeMicros >= lineNext && Serial.rxLen < sizeof(Serial.rx))
+  {
+    Serial.feed(line + linePos++, 1);
+    lineNext += LINE_USEC;
+  }
+}
+
+static void send(const uint8_t *bytes, size_t len)
+{
+  memcpy(line + lineLen, bytes, len);
+  lineLen += len;
+}
+
+// runs the loop for usecs, counting the frequencies it tunes to
+static uint32_t run(uint32_t usecs, bool saveEach)
+{
+  uint32_t end = fakeMicros + usecs;
+  uint32_t last = settings.frequency;
+  uint32_t tuned = 0;
+
+  while ((int32_t)(fakeMicros - end) < 0)
+  {
+    loop();
+    fakeAdvance(50); // the rest of a pass on the radio
+    if (settings.frequency != last)
+    {
+      last = settings.frequency;
+      tuned++;
+      if (saveEach)
+        saveVfoLater(VFO_A); // as if every frame were a vfo change the menu saves
+    }
+  }
+  return tuned;
+}
+
+// user-020: frames back to back at the line rate, for a second
+static void testSustained()
+{
+  static const uint8_t streamOn[5] = {1, 0, 0, 0, 0xD7};
+
+  simulateIO = 0;
+  fakeAnalog[PIN_ANALOG_KEYER] = 1023; // the paddles up
+  twiLive(true);
+  fakeOnMicros = lineTick;
+  setup();
+  Serial.reset();
+  lineLen = linePos = 0;
+  lineNext = fakeMicros;
+
+  send(streamOn, sizeof(streamOn));
+  uint32_t frames = 1000000L / (7 * LINE_USEC);
+  for (uint32_t i = 0; i < frames; i++)
+    frame(i, 7000000 + 100 * i);
+  uint32_t writes = EEPROM.writes;
+  uint32_t bus = busBytes;
+  uint32_t tuned = run(1100000L, false); // a little over, for the last frame to come in whole
+  CHECK(linePos == lineLen);
+  CHECK_EQ(settings.frequency, 7000000 + 100 * (frames - 1));
+  CHECK(tuned >= frames * 9 / 10); // hardly any replaced, the loop keeps up with the line
+  CHECK_EQ(EEPROM.writes, writes);
+  uint32_t busy = (busBytes - bus) * TWI_BYTE_USEC;
+
+  // with every frame marking the vfo for saving, it is written once, after the stream stops
+  for (uint32_t i = 0; i < frames; i++)
+    frame(i, 7200000 + 100 * i);
+  run(1000000L, true);
+  CHECK_EQ(EEPROM.writes, writes);
+  run(3000000L, false);
+  CHECK(EEPROM.writes > writes);
+  CHECK(EEPROM.writes <= writes + 5); // the vfo and its mode
+  CHECK_EQ(EEPROM.read(VFO_A) | (uint32_t)EEPROM.read(VFO_A + 1) << 8 | (uint32_t)EEPROM.read(VFO_A + 2) << 16 |
+               (uint32_t)EEPROM.read(VFO_A + 3) << 24,
+           settings.vfoA);
+
+  printf("  stream: %u of %u frames a second tuned, the bus busy %u%% of the time, no EEPROM writes while streaming\n",
+         tuned, frames, busy / 10000);
+  fakeOnMicros = NULL;
+}
+
+int main()
+{
+  testSustained();
+  TEST_DONE();
+}
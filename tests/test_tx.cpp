@@ -0,0 +1,183 @@
+/**
+ * The T/R switch and the oscillator banks behind it
+ */
+
+#include "../src/ubitx_main.cpp"
+#include "twi.h"
+
+// the registers the oscillators use: the output enables, the clock controls, PLLB and the msynths
+static bool sameOscillators(const uint8_t *a, const uint8_t *b)
+{
+  return a[3] == b[3] && memcmp(a + 16, b + 16, 3) == 0 && memcmp(a + 34, b + 34, 32) == 0;
+}
+
+static void receive(uint32_t f)
+{
+  twiLive(true);
+  usbCarrier = 11052000;
+  settings.sideTone = 800;
+  settings.isUSB = false;
+  settings.ritOn = false;
+  settings.splitOn = false;
+  si5351bx_setfreq(0, usbCarrier);
+  setFrequency(f);
+  i2cFlush();
+  prepareTx();
+}
+
+// user-006: a bank that no longer matches is computed afresh, with the same result
+static void testFallback()
+{
+  uint8_t fromBank[256], computed[256], rx[256];
+
+  initOscillators(0);
+  receive(7100000);
+  memcpy(rx, chipRegs, sizeof(rx));
+
+  // from the bank the loop prepared
+  CHECK(bankMatches(&txCwBank, cwCarrier(7100000, false), false));
+  startTx(TX_CW);
+  memcpy(fromBank, chipRegs, sizeof(fromBank));
+  stopTx();
+  i2cFlush();
+  CHECK(sameOscillators(chipRegs, rx));
+
+  // the sidetone changed and the loop hasn't run since: the bank is stale
+  settings.sideTone = 600;
+  CHECK(!bankMatches(&txCwBank, cwCarrier(7100000, false), false));
+  startTx(TX_CW);
+  memcpy(computed, chipRegs, sizeof(computed));
+  CHECK(!sameOscillators(computed, fromBank));
+  stopTx();
+  i2cFlush();
+  prepareTx();
+  startTx(TX_CW);
+  CHECK(sameOscillators(chipRegs, computed));
+  stopTx();
+  i2cFlush();
+
+  // ssb the same way, the carrier was moved (as the bfo menu does) under the bank
+  CHECK(bankMatches(&txSsbBank, 7100000, false));
+  usbCarrier += 100;
+  si5351bx_setfreq(0, usbCarrier);
+  startTx(TX_SSB);
+  memcpy(computed, chipRegs, sizeof(computed));
+  stopTx();
+  i2cFlush();
+  prepareTx();
+  CHECK(bankMatches(&txSsbBank, 7100000, false));
+  startTx(TX_SSB);
+  CHECK(sameOscillators(chipRegs, computed));
+
+  // recalibrated while transmitting: the rx bank is refused and the receiver computed again
+  si5351_set_calibration(500);
+  stopTx();
+  i2cFlush();
+  memcpy(rx, chipRegs, sizeof(rx));
+  CHECK(bankMatches(&rxBank, 7100000, false));
+  si5351_set_calibration(0);
+  twiLive(false);
+}
+
+// how long a T/R switch takes until the oscillators are on the new frequency
+static void timeSwitch()
+{
+  const int rounds = 20000;
+  volatile bool ok = true;
+
+  initOscillators(0);
+  receive(14074000);
+
+  uint32_t start = fakeMicros;
+  startTx(TX_CW);
+  uint32_t toTx = fakeMicros - start;
+  start = fakeMicros;
+  stopTx();
+  i2cFlush();
+  uint32_t toRx = fakeMicros - start;
+
+  // the staging itself, from a bank and computed, on the host
+  uint32_t f = cwCarrier(settings.frequency, settings.isUSB);
+  uint64_t t = testNanos();
+  for (int i = 0; i < rounds; i++)
+    ok = ok && si5351bx_load(&txCwBank.osc);
+  uint64_t fromBank = testNanos() - t;
+  t = testNanos();
+  for (int i = 0; i < rounds; i++)
+  {
+    // what startTx() did before the banks, the receive dividers in between as on the radio
+    stageFrequency(settings.frequency);
+    si5351bx_stage(0, 0);
+    si5351bx_stage(1, 0);
+    si5351bx_stage(2, f);
+    si5351bx_load(&rxBank.osc);
+  }
+  uint64_t computed = testNanos() - t;
+  t = testNanos();
+  for (int i = 0; i < rounds; i++)
+    si5351bx_load(&rxBank.osc);
+  computed -= testNanos() - t;
+  CHECK(ok);
+  si5351bx_commit();
+  twiRun();
+
+  printf("  tx: rx to cw tx takes %u usecs and back %u usecs, mostly the bus;"
+         " staging takes %.0f nsecs from the bank, %.0f nsecs computed (on the host)\n",
+         toTx, toRx, fromBank / (double)rounds, computed / (double)rounds);
+}
+
+static uint32_t pressAt, releaseAt;
+static int catWaiting;
+static uint32_t catFrequency;
+
+// the bus runs, and the button goes down and up at the given times
+static void operatorTick()
+{
+  fakeAdvance(10); // the loop around it
+  twiTick();
+  if (fakeMicros >= releaseAt)
+    fakePins[PIN_FBUTTON] = HIGH;
+  else if (fakeMicros >= pressAt && fakePins[PIN_FBUTTON] == HIGH)
+  {
+    fakePins[PIN_FBUTTON] = LOW;
+    catWaiting = Serial.available();
+    catFrequency = settings.frequency;
+  }
+}
+
+// user-009: CAT doesn't get at the oscillators while the clock is calibrated
+static void testCalibrationHeld()
+{
+  static const uint8_t tune[5] = {0x01, 0x42, 0x00, 0x00, 0x01}; // 14.200 MHz
+
+  initOscillators(0);
+  receive(7100000);
+  sched_init(tasks, sizeof(tasks) / sizeof(tasks[0]));
+  simulateIO = 0;
+  fakePins[PIN_PTT] = HIGH;
+  fakePins[PIN_FBUTTON] = HIGH;
+  Serial.reset();
+  Serial.feed(tune, sizeof(tune));
+  pressAt = fakeMicros + 300000L;
+  releaseAt = pressAt + 100000L;
+  catWaiting = -1;
+  fakeOnMicros = operatorTick;
+
+  calibrateClock();
+  CHECK_EQ(catWaiting, 5); // nobody read it while calibrating
+  CHECK_EQ(catFrequency, 7100000);
+
+  // and it is answered once the calibration is over
+  active_delay(100);
+  CHECK_EQ(Serial.available(), 0);
+  CHECK_EQ(settings.frequency, 14200000);
+  twiLive(false);
+}
+
+int main()
+{
+  testFallback();
+  testCalibrationHeld();
+  timeSwitch();
+  TEST_DONE();
+}
@@ -0,0 +1,50 @@
+/**
+ * The stall watchdog
+ */
+
+#include "../src/ubitx_watchdog.cpp"
+#include "test.h"
+
+// user-013: the breadcrumb goes to the EEPROM history, not onto the CAT port
+static void testBreadcrumb()
+{
+  Serial.reset();
+  watchdogReset();
+  crumb.task = 3;
+  crumb.cat = 0x88;
+  crumb.loops = 123456;
+  crumb.sp = 0x08F0;
+  crumbMagic = WDT_MAGIC;
+
+  watchdogInit();
+  CHECK_EQ(Serial.txLen, 0);
+  CHECK_EQ(EEPROM.read(WDT_HISTORY), 1);
+  crumb_t kept;
+  EEPROM.get(WDT_HISTORY + 1, kept);
+  CHECK(memcmp(&kept, &crumb, sizeof(kept)) == 0);
+
+  // filed once only
+  watchdogInit();
+  CHECK_EQ(EEPROM.read(WDT_HISTORY), 1);
+
+  // and read back through CAT
+  watchdogSend();
+  CHECK_EQ(Serial.txLen, 1 + WDT_HISTORY_SIZE * sizeof(crumb_t));
+  CHECK_EQ(Serial.tx[0], 1);
+  CHECK_EQ(Serial.tx[2], 0x88);
+}
+
+// not armed unless config.h asks for it, the old bootloader would reset-loop
+static void testArm()
+{
+  WDTCSR = 0;
+  watchdogArm();
+  CHECK_EQ(WDTCSR, STALL_WATCHDOG ? _BV(WDIE) | _BV(WDE) | _BV(WDP2) | _BV(WDP1) : 0);
+}
+
+int main()
+{
+  testBreadcrumb();
+  testArm();
+  TEST_DONE();
+}
@@ -0,0 +1,106 @@
+#ifndef TWI_H
+#define TWI_H
+
+/**
+ * Plays the part of the TWI hardware and the Si5351 for the i2c queue: the
+ * interrupt handler is called with the status the hardware would give until
+ * the queue is empty, and each register write lands in chipRegs. The
+ * transaction numbered nack (counting from 0 in this run) has its address
+ * refused.
+ *
+ * twiRun() empties the queue at once. With twiLive() on, the bus moves on
+ * its own instead, one byte every TWI_BYTE_USEC of fake time, so a wait for
+ * room in the queue lasts as long as it would on the radio.
+ */
+
+#include <Arduino.h>
+#include "test.h"
+
+extern "C" void TWI_vect(void);
+bool i2cBusy();
+
+#define TWI_BYTE_USEC 23 // 9 clocks at 400 khz
+
+static uint8_t chipRegs[256];
+static uint32_t chipBytes = 0;        // register bytes written, not counting the address and register number
+static uint32_t chipTransactions = 0;
+static uint32_t busBytes = 0;         // every byte on the bus, addresses and register numbers too
+
+static int twiIndex = -1;   // the transaction on the bus, counting from 0 in this run
+static int twiNack = -1;
+static uint8_t twiPhase = 0; // 0: start sent, 1: address sent, 2: register number sent
+static uint8_t twiReg = 0;
+
+// one interrupt of the TWI, false when there is nothing to do
+static bool twiStep()
+{
+  if (TWCR & _BV(TWSTO))
+  { // the hardware clears the stop bit when the stop is on the bus
+    TWCR &= ~_BV(TWSTO);
+    return true;
+  }
+  if (!i2cBusy())
+    return false;
+
+  if (TWCR & _BV(TWSTA))
+    TWSR = 0x08;
+  else if (twiPhase == 1)
+    TWSR = twiIndex == twiNack ? 0x20 : 0x18;
+  else
+    TWSR = 0x28;
+
+  TWI_vect();
+
+  if (TWCR & (_BV(TWSTO) | _BV(TWSTA)))
+  { // a stop, or a repeated start for the next transaction
+    twiPhase = 0;
+    return true;
+  }
+  busBytes++;
+  switch (twiPhase)
+  {
+  case 0:
+    CHECK_EQ(TWDR, 0x60 << 1);
+    twiIndex++;
+    chipTransactions++;
+    twiPhase = 1;
+    break;
+  case 1:
+    twiReg = TWDR;
+    twiPhase = 2;
+    break;
+  default:
+    chipRegs[twiReg++] = TWDR;
+    chipBytes++;
+    break;
+  }
+  return true;
+}
+
+static void twiRun(int nack = -1)
+{
+  twiIndex = -1;
+  twiNack = nack;
+  while (twiStep())
+    ;
+  twiNack = -1;
+}
+
+static uint32_t twiLast;
+
+static void twiTick()
+{
+  if (fakeMicros - twiLast >= TWI_BYTE_USEC)
+  {
+    twiLast = fakeMicros;
+    twiStep();
+  }
+}
+
+static void twiLive(bool on)
+{
+  twiLast = fakeMicros;
+  fakeOnMicros = on ? twiTick : NULL;
+}
+
+#endif
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""
+Bridge between the uBITX in push mode and programs that poll it.
+
+The bridge turns push mode on (private CAT command 0xD6) and keeps the
+frequency/mode and tx status the radio pushes when they change. It opens a
+pseudo terminal for the logger or hamlib (use it as an FT-817 port):
+the frequency (0x03) and tx status (0xF7) polls are answered from what the
+radio last pushed, every other command is passed on to the radio and its
+reply passed back.
+
+    cat_push_bridge.py /dev/ttyUSB0
+
+This needs pyserial and a system with pseudo terminals (Linux, macOS).
+"""
+
+import argparse
+import os
+import select
+import sys
+import time
+import tty
+
+import serial
+
+# bytes in the reply to each command, those not listed reply with one byte
+REPLY_LEN = {0x02: 0, 0x82: 0, 0x03: 5, 0xBB: 2, 0xD0: 44, 0xD3: 33, 0xD4: 8}
+# replies that are a count, then that many entries of this many bytes
+COUNTED_LEN = {0xD1: 8, 0xD2: 5, 0xD5: 10}
+PUSH_LEN = {0x03: 5, 0xF7: 1}
+TIMEOUT = 0.5
+
+
+def reply_len(op, rx):
+    """the length of the reply to op at the start of rx, None until it is known"""
+    if op in COUNTED_LEN:
+        return 1 + rx[0] * COUNTED_LEN[op] if rx else None
+    return REPLY_LEN.get(op, 1)
+
+
+class Radio:
+    def __init__(self, port, baud):
+        self.port = serial.Serial(port, baud, timeout=0)
+        # opening the port may reset the nano, wait for the bootloader to pass
+        time.sleep(2)
+        self.port.reset_input_buffer()
+        self.rx = bytearray()
+        self.state = {}  # command -> the pushed reply
+        self.waiting = None  # the command whose reply is due
+        self.reply = None
+
+    def fileno(self):
+        return self.port.fileno()
+
+    def poll(self):
+        """reads what has come in and takes it apart a message at a time
+
+        The radio sends a reply or a push whole, so messages never overlap.
+        Between two messages FE FE and a push opcode start a push, a reply
+        to an FT-817 command never starts that way (the frequency is BCD).
+        Anything else is the reply that is due, or noise when none is.
+        """
+        self.rx += self.port.read(256)
+        while self.rx:
+            if self.rx[0] == 0xFE:
+                if len(self.rx) < 3:
+                    return
+                n = PUSH_LEN.get(self.rx[2]) if self.rx[1] == 0xFE else None
+                if n is not None:
+                    if len(self.rx) < 3 + n:
+                        return
+                    self.state[self.rx[2]] = bytes(self.rx[3 : 3 + n])
+                    del self.rx[: 3 + n]
+                    continue
+            if self.waiting is None:
+                del self.rx[:1]  # not ours, drop it and look again
+                continue
+            n = reply_len(self.waiting, self.rx)
+            if n is None or len(self.rx) < n:
+                return
+            self.reply = bytes(self.rx[:n])
+            self.waiting = None
+            del self.rx[:n]
+
+    def command(self, frame):
+        """sends a command and waits for its reply, pushes on the way are kept"""
+        self.port.write(frame)
+        if REPLY_LEN.get(frame[4]) == 0:
+            return b""
+        self.waiting = frame[4]
+        self.reply = None
+        end = time.monotonic() + TIMEOUT
+        self.poll()
+        while self.reply is None and time.monotonic() < end:
+            select.select([self.port], [], [], 0.01)
+            self.poll()
+        self.waiting = None
+        return self.reply or b""
+
+    def push_mode(self, on):
+        self.command(bytes([1 if on else 0, 0, 0, 0, 0xD6]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("port", help="serial port of the radio")
+    parser.add_argument("--baud", type=int, default=38400)
+    args = parser.parse_args()
+
+    radio = Radio(args.port, args.baud)
+    radio.push_mode(True)
+
+    master, slave = os.openpty()
+    tty.setraw(slave)
+    print("FT-817 port for the logger:", os.ttyname(slave))
+
+    frame = bytearray()
+    try:
+        while True:
+            ready, _, _ = select.select([master, radio], [], [])
+            if radio in ready:
+                radio.poll()
+            if master not in ready:
+                continue
+
+            frame += os.read(master, 64)
+            while len(frame) >= 5:
+                cmd, frame = bytes(frame[:5]), frame[5:]
+                op = cmd[4]
+                if op in radio.state:
+                    reply = radio.state[op]
+                else:
+                    reply = radio.command(cmd)
+                    if op in (0x03, 0xF7) and reply:
+                        radio.state[op] = reply
+                os.write(master, reply)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        radio.push_mode(False)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
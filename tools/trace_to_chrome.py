@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""
+Turns the event trace of the uBITX (TRACE_EVENTS in config.h) into the
+Chrome trace_event JSON format. Open the result in chrome://tracing or
+https://ui.perfetto.dev to see the timeline.
+
+The trace is either read from the radio:
+
+    trace_to_chrome.py --port /dev/ttyUSB0 trace.json
+
+(this needs pyserial), or from a file holding the raw reply to the 0xD2
+CAT command:
+
+    trace_to_chrome.py --dump trace.bin trace.json
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+TICK_US = 64
+
+# event: (name, lane, phase), 'B'/'E' open and close a span, 'i' is an instant
+EVENTS = {
+    1: ("tx", "tx", "B"),
+    2: ("tx", "tx", "E"),
+    3: ("frequency", "tuning", "i"),
+    4: ("cat", "cat", "i"),
+    5: ("key", "keyer", "B"),
+    6: ("key", "keyer", "E"),
+    7: ("menu", "menu", "B"),
+    8: ("menu", "menu", "E"),
+    9: ("i2c", "i2c", "i"),
+}
+
+LANES = ["tx", "keyer", "tuning", "cat", "menu", "i2c"]
+
+
+def read_radio(port, baud, clear):
+    import serial
+
+    # raising DTR on open resets the nano and the trace ring with it,
+    # so the port is set up closed with DTR held low and opened after
+    s = serial.Serial()
+    s.port = port
+    s.baudrate = baud
+    s.timeout = 2
+    s.dsrdtr = False
+    s.dtr = False
+    s.rts = False
+    s.open()
+    with s:
+        s.reset_input_buffer()
+        s.write(bytes([1 if clear else 0, 0, 0, 0, 0xD2]))
+        count = s.read(1)
+        if not count:
+            sys.exit("no reply from the radio")
+        return count + s.read(count[0] * 5)
+
+
+def parse(dump):
+    if not dump:
+        sys.exit("empty dump")
+    count = dump[0]
+    if count == 0:
+        sys.exit("the trace is empty or not built in (TRACE_EVENTS in config.h)")
+    if len(dump) < 1 + count * 5:
+        sys.exit("the dump is short, %d of %d entries" % ((len(dump) - 1) // 5, count))
+    return [struct.unpack_from("<HBH", dump, 1 + i * 5) for i in range(count)]
+
+
+def convert(entries):
+    events = []
+    for i, lane in enumerate(LANES):
+        events.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": i,
+                       "args": {"name": lane}})
+
+    ts = 0
+    for ticks, event, arg in entries:
+        ts += ticks * TICK_US
+        name, lane, phase = EVENTS.get(event, ("event %d" % event, "cat", "i"))
+        e = {"name": name, "ph": phase, "ts": ts, "pid": 1, "tid": LANES.index(lane)}
+        if phase == "i":
+            e["s"] = "t"
+        if event == 1:
+            e["args"] = {"mode": arg}
+        elif event == 3:
+            e["args"] = {"khz": arg}
+        elif event == 4:
+            e["args"] = {"opcode": "0x%02X" % arg}
+        elif event == 7:
+            e["args"] = {"calibrate": arg}
+        elif event == 9:
+            e["args"] = {"register": arg >> 8, "bytes": arg & 0xFF}
+        elif event not in EVENTS:
+            e["args"] = {"arg": arg}
+        events.append(e)
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("--port", help="serial port of the radio")
+    source.add_argument("--dump", help="file with the raw reply to the 0xD2 command")
+    parser.add_argument("--baud", type=int, default=38400)
+    parser.add_argument("--clear", action="store_true", help="clear the trace after reading it")
+    parser.add_argument("output", help="JSON file to write")
+    args = parser.parse_args()
+
+    if args.port:
+        dump = read_radio(args.port, args.baud, args.clear)
+    else:
+        with open(args.dump, "rb") as f:
+            dump = f.read()
+
+    with open(args.output, "w") as f:
+        json.dump(convert(parse(dump)), f, indent=1)
+
+
+if __name__ == "__main__":
+    main()